@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace mozaic::bench
+{
+	// A benchmark body runs the measured operation `iterations` times. items is the number of elements one iteration
+	// processes (0 if not meaningful), and bytes is the number of bytes it touches, used to derive per-item and throughput figures.
+	struct benchmark
+	{
+		std::string name;
+		std::function<void(size_t iterations)> body;
+		size_t items = 0;
+		size_t bytes = 0;
+	};
+
+	inline std::vector<benchmark>& benchmarks()
+	{
+		static std::vector<benchmark> list;
+		return list;
+	}
+
+	inline void add(std::string name, std::function<void(size_t)> body, size_t items = 0, size_t bytes = 0)
+	{
+		benchmarks().push_back({ std::move(name), std::move(body), items, bytes });
+	}
+
+	struct registrar
+	{
+		registrar(std::string name, std::function<void(size_t)> body, size_t items = 0, size_t bytes = 0)
+		{
+			add(std::move(name), std::move(body), items, bytes);
+		}
+	};
+
+	// Keeps the compiler from discarding a computed value or the stores that produced it.
+	template<typename T>
+	inline void do_not_optimize(const T& value)
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		asm volatile("" : : "r,m"(value) : "memory");
+#else
+		static volatile const void* sink;
+		sink = &value;
+#endif
+	}
+
+	inline void clobber_memory()
+	{
+#if defined(__GNUC__) || defined(__clang__)
+		asm volatile("" : : : "memory");
+#else
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+	}
+
+	// Deterministic generator so that every run benchmarks identical data.
+	struct xorshift
+	{
+		unsigned long long state = 0x9E3779B97F4A7C15ull;
+
+		unsigned long long operator()()
+		{
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			return state;
+		}
+	};
+}
+
+#define MOZAIC_BENCH_CONCAT_(a, b) a##b
+#define MOZAIC_BENCH_CONCAT(a, b) MOZAIC_BENCH_CONCAT_(a, b)
+#define MOZAIC_BENCHMARK(...) static const ::mozaic::bench::registrar MOZAIC_BENCH_CONCAT(_mozaic_bench_, __COUNTER__)(__VA_ARGS__)
@@ -0,0 +1,110 @@
+#include "bench.hpp"
+
+#include "include/buffers.hpp"
+#include "include/resample.hpp"
+
+#include <string>
+
+using namespace mozaic;
+
+namespace
+{
+	buffer2d make_buffer(size_t width, size_t height, size_t chpp)
+	{
+		buffer2d buf(width, height, chpp, false);
+		bench::xorshift rng;
+		for (size_t i = 0; i < buf.bytes(); ++i)
+			buf.buffer()[i] = std::byte(rng());
+		return buf;
+	}
+
+	void register_buffer2d(size_t width, size_t height, size_t chpp)
+	{
+		const std::string size = std::to_string(width) + "x" + std::to_string(height) + "x" + std::to_string(chpp);
+		const size_t bytes = width * height * chpp;
+		bench::add("buffer2d/flip_vertically/" + size, [=](size_t iterations) {
+			buffer2d buf = make_buffer(width, height, chpp);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				buf.flip_vertically();
+				bench::clobber_memory();
+			}
+			}, width * height, 2 * bytes);
+		bench::add("buffer2d/flip_horizontally/" + size, [=](size_t iterations) {
+			buffer2d buf = make_buffer(width, height, chpp);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				buf.flip_horizontally();
+				bench::clobber_memory();
+			}
+			}, width * height, 2 * bytes);
+		bench::add("buffer2d/set_rect/" + size, [=](size_t iterations) {
+			buffer2d buf = make_buffer(width, height, chpp);
+			std::byte pixel[4] = { std::byte(1), std::byte(2), std::byte(3), std::byte(4) };
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				buf.set(pixel, upright_rect{ 0, width - 1, 0, height - 1 });
+				bench::clobber_memory();
+			}
+			}, width * height, bytes);
+		bench::add("buffer2d/set_lines/" + size, [=](size_t iterations) {
+			buffer2d buf = make_buffer(width, height, chpp);
+			std::byte pixel[4] = { std::byte(1), std::byte(2), std::byte(3), std::byte(4) };
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				for (size_t y = 0; y < height; y += 16)
+					buf.set(pixel, horizontal_line{ y, 0, width - 1 });
+				for (size_t x = 0; x < width; x += 16)
+					buf.set(pixel, vertical_line{ x, 0, height - 1 });
+				bench::clobber_memory();
+			}
+			}, (width + height) / 16);
+		bench::add("buffer2d/set_tracked/" + size, [=](size_t iterations) {
+			buffer2d buf = make_buffer(width, height, chpp);
+			buf.track_damage(true);
+			std::byte pixel[4] = { std::byte(1), std::byte(2), std::byte(3), std::byte(4) };
+			bench::xorshift rng;
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				size_t x = rng() % width, y = rng() % height;
+				buf.set(pixel, upright_rect{ x, x + 7, y, y + 7 });
+				if (i % 64 == 63)
+					buf.clear_damage();
+			}
+			bench::do_not_optimize(buf.damage().area());
+			});
+	}
+
+	void register_resample(size_t width, size_t height, size_t chpp)
+	{
+		const std::string size = std::to_string(width) + "x" + std::to_string(height) + "x" + std::to_string(chpp);
+		const std::pair<const char*, resample_filter> filters[] = { { "box", resample_filter::box }, { "bilinear", resample_filter::bilinear }, { "lanczos", resample_filter::lanczos } };
+		for (const auto& [name, filter] : filters)
+		{
+			bench::add(std::string("resample/downscale_") + name + "/" + size, [=](size_t iterations) {
+				buffer2d src = make_buffer(width, height, chpp);
+				buffer2d dst(width / 3, height / 3, chpp, false);
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					resize(src, dst, filter, 1);
+					bench::clobber_memory();
+				}
+				}, width * height, width * height * chpp);
+		}
+		bench::add("resample/mipmap_chain/" + size, [=](size_t iterations) {
+			buffer2d src = make_buffer(width, height, chpp);
+			for (size_t i = 0; i < iterations; ++i)
+				bench::do_not_optimize(mipmap_chain(src, 0, 1).size());
+			}, width * height, width * height * chpp);
+	}
+
+	const bool registered = [] {
+		register_buffer2d(256, 256, 4);
+		register_buffer2d(1024, 1024, 4);
+		register_buffer2d(1024, 1024, 1);
+		register_resample(1024, 1024, 4);
+		register_resample(1024, 1024, 3);
+		register_resample(1024, 1024, 1);
+		return true;
+		}();
+}
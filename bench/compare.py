@@ -0,0 +1,51 @@
+#!/usr/bin/env python3
+"""Compare two mozaic_bench JSON files.
+
+Usage: compare.py <baseline.json> <candidate.json> [--threshold PERCENT]
+
+Prints the median ns/op change for every benchmark present in both files, and exits with status 1 if any benchmark
+regressed by more than the threshold (default 10%).
+"""
+
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        return {r["name"]: r for r in json.load(f)["results"]}
+
+
+def main(argv):
+    args = [a for a in argv[1:] if not a.startswith("--")]
+    threshold = 10.0
+    if "--threshold" in argv:
+        threshold = float(argv[argv.index("--threshold") + 1])
+        args.remove(argv[argv.index("--threshold") + 1])
+    if len(args) != 2:
+        print(__doc__, file=sys.stderr)
+        return 2
+
+    base, cand = load(args[0]), load(args[1])
+    regressions = 0
+    width = max((len(n) for n in base if n in cand), default=0)
+    for name, b in base.items():
+        if name not in cand:
+            continue
+        before = b["ns_per_op"]["median"]
+        after = cand[name]["ns_per_op"]["median"]
+        change = (after - before) / before * 100.0 if before else 0.0
+        flag = ""
+        if change > threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif change < -threshold:
+            flag = "  improvement"
+        print(f"{name:<{width}}  {before:14.1f} -> {after:14.1f} ns/op  {change:+7.1f}%{flag}")
+    for name in sorted(set(base) ^ set(cand)):
+        print(f"{name:<{width}}  only in {'baseline' if name in base else 'candidate'}")
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
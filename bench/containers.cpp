@@ -0,0 +1,321 @@
+#include "bench.hpp"
+
+#include "include/array.hpp"
+#include "include/copy_ptr.hpp"
+#include "include/registry.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace mozaic;
+
+namespace
+{
+	template<size_t Len>
+	void register_array()
+	{
+		const std::string size = std::to_string(Len);
+		bench::add("array/copy_construct/" + size, [](size_t iterations) {
+			const array<int, Len> src(7);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				array<int, Len> dst(src);
+				bench::do_not_optimize(dst.get());
+			}
+			}, Len, Len * sizeof(int));
+		bench::add("array/copy/" + size, [](size_t iterations) {
+			array<int, Len> src(7);
+			array<int, Len> dst;
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				dst.copy(0, src.get(), Len);
+				bench::clobber_memory();
+			}
+			}, Len, Len * sizeof(int));
+		bench::add("array/subarray/" + size, [](size_t iterations) {
+			const array<int, Len> src(7);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				auto sub = src.template subarray<Len / 2>(Len / 4);
+				bench::do_not_optimize(sub.get());
+			}
+			}, Len / 2, Len / 2 * sizeof(int));
+	}
+
+	void register_var_array(size_t len)
+	{
+		const std::string size = std::to_string(len);
+		bench::add("var_array/copy_construct/" + size, [len](size_t iterations) {
+			var_array<int> src(7, len);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				var_array<int> dst(src);
+				bench::do_not_optimize(dst.get());
+			}
+			}, len, len * sizeof(int));
+		bench::add("var_array/copy_assign/" + size, [len](size_t iterations) {
+			var_array<int> src(7, len);
+			var_array<int> dst(len);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				dst = src;
+				bench::clobber_memory();
+			}
+			}, len, len * sizeof(int));
+		bench::add("var_array/copy/" + size, [len](size_t iterations) {
+			var_array<int> src(7, len);
+			var_array<int> dst(len);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				dst.copy(0, src.get(), len);
+				bench::clobber_memory();
+			}
+			}, len, len * sizeof(int));
+		bench::add("var_array/resize_grow_shrink/" + size, [len](size_t iterations) {
+			var_array<int> arr(7, len);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				arr.resize(2 * len);
+				arr.resize(len);
+				bench::do_not_optimize(arr.get());
+			}
+			}, len, 3 * len * sizeof(int));
+		bench::add("var_array/subarray/" + size, [len](size_t iterations) {
+			var_array<int> src(7, len);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				var_array<int> sub = src.subarray(len / 4, len / 2);
+				bench::do_not_optimize(sub.get());
+			}
+			}, len / 2, len / 2 * sizeof(int));
+	}
+
+	// Index loops over the same data through a raw pointer, operator[] and at(). With bounds checking compiled out,
+	// operator[] must vectorize like the raw pointer. Sequential loops let the compiler prove at() in range, so gather
+	// reads through data-dependent indices to show the cost of checking every element.
+	template<typename Array>
+	void register_indexing(const std::string& type, Array make())
+	{
+		const size_t len = make().length();
+		const std::string size = std::to_string(len);
+		bench::add(type + "/index_sum/raw/" + size, [make](size_t iterations) {
+			Array arr = make();
+			const int* p = arr.get();
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				int sum = 0;
+				for (size_t j = 0; j < arr.length(); ++j)
+					sum += p[j];
+				bench::do_not_optimize(sum);
+			}
+			}, len, len * sizeof(int));
+		bench::add(type + "/index_sum/operator[]/" + size, [make](size_t iterations) {
+			Array arr = make();
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				int sum = 0;
+				for (size_t j = 0; j < arr.length(); ++j)
+					sum += arr[j];
+				bench::do_not_optimize(sum);
+			}
+			}, len, len * sizeof(int));
+		bench::add(type + "/index_sum/at/" + size, [make](size_t iterations) {
+			Array arr = make();
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				int sum = 0;
+				for (size_t j = 0; j < arr.length(); ++j)
+					sum += arr.at(j);
+				bench::do_not_optimize(sum);
+			}
+			}, len, len * sizeof(int));
+		bench::add(type + "/index_scale/raw/" + size, [make](size_t iterations) {
+			Array arr = make();
+			int* p = arr.get();
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				for (size_t j = 0; j < arr.length(); ++j)
+					p[j] = 3 * p[j] + 1;
+				bench::clobber_memory();
+			}
+			}, len, 2 * len * sizeof(int));
+		bench::add(type + "/index_scale/operator[]/" + size, [make](size_t iterations) {
+			Array arr = make();
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				for (size_t j = 0; j < arr.length(); ++j)
+					arr[j] = 3 * arr[j] + 1;
+				bench::clobber_memory();
+			}
+			}, len, 2 * len * sizeof(int));
+		bench::add(type + "/index_scale/at/" + size, [make](size_t iterations) {
+			Array arr = make();
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				for (size_t j = 0; j < arr.length(); ++j)
+					arr.at(j) = 3 * arr.at(j) + 1;
+				bench::clobber_memory();
+			}
+			}, len, 2 * len * sizeof(int));
+		const auto gather = [](size_t len, auto read) {
+			return [len, read](size_t iterations) {
+				std::vector<size_t> indices(len);
+				bench::xorshift rng;
+				for (size_t& index : indices)
+					index = size_t(rng() % len);
+				for (size_t i = 0; i < iterations; ++i)
+				{
+					int sum = 0;
+					for (size_t index : indices)
+						sum += read(index);
+					bench::do_not_optimize(sum);
+				}
+				};
+			};
+		const auto shared = std::make_shared<Array>(make());
+		bench::add(type + "/index_gather/raw/" + size, gather(len, [shared](size_t i) { return shared->get()[i]; }), len);
+		bench::add(type + "/index_gather/operator[]/" + size, gather(len, [shared](size_t i) { return (*shared)[i]; }), len);
+		bench::add(type + "/index_gather/at/" + size, gather(len, [shared](size_t i) { return shared->at(i); }), len);
+	}
+
+	struct element
+	{
+		float x = 0.0f;
+		std::string name;
+
+		element(float x) : x(x), name("element") {}
+		virtual ~element() = default;
+	};
+
+	struct derived_element : public element
+	{
+		double payload[8] = {};
+
+		derived_element(float x) : element(x) {}
+	};
+
+	struct key
+	{
+		unsigned v;
+
+		bool operator==(const key& other) const { return v == other.v; }
+	};
+}
+
+template<>
+struct std::hash<key>
+{
+	size_t operator()(const key& k) const { return std::hash<unsigned>{}(k.v); }
+};
+
+namespace
+{
+	struct keyed_element
+	{
+		unsigned v;
+
+		keyed_element(const key& k) : v(k.v) {}
+	};
+
+	using element_registry = registry<keyed_element, unsigned, key>;
+
+	void register_copy_ptr()
+	{
+		bench::add("copy_ptr/copy_construct", [](size_t iterations) {
+			const copy_ptr<element> src(new element(1.0f));
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				copy_ptr<element> dst(src);
+				bench::do_not_optimize(dst.get());
+			}
+			});
+		bench::add("copy_ptr/copy_construct_polymorphic", [](size_t iterations) {
+			const copy_ptr<derived_element> src(new derived_element(1.0f));
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				copy_ptr<element> dst(src);
+				bench::do_not_optimize(dst.get());
+			}
+			});
+		bench::add("copy_ptr/copy_assign", [](size_t iterations) {
+			const copy_ptr<element> src(new element(1.0f));
+			copy_ptr<element> dst(new element(2.0f));
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				dst = src;
+				bench::do_not_optimize(dst.get());
+			}
+			});
+	}
+
+	void register_registry(size_t n)
+	{
+		const std::string size = std::to_string(n);
+		bench::add("registry/add/" + size, [n](size_t iterations) {
+			element_registry reg;
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				for (size_t j = 0; j < n; ++j)
+					bench::do_not_optimize(reg.add(keyed_element(key{ unsigned(j) })));
+				reg.clear();
+			}
+			}, n);
+		bench::add("registry/get/" + size, [n](size_t iterations) {
+			element_registry reg;
+			std::vector<element_registry::Handle> handles;
+			for (size_t j = 0; j < n; ++j)
+				handles.push_back(reg.add(keyed_element(key{ unsigned(j) })));
+			bench::xorshift rng;
+			std::vector<element_registry::Handle> order;
+			for (size_t j = 0; j < n; ++j)
+				order.push_back(handles[rng() % n]);
+			for (size_t i = 0; i < iterations; ++i)
+				for (element_registry::Handle h : order)
+					bench::do_not_optimize(reg.get(h));
+			}, n);
+		bench::add("registry/construct_new/" + size, [n](size_t iterations) {
+			element_registry reg;
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				for (size_t j = 0; j < n; ++j)
+					bench::do_not_optimize(reg.construct(key{ unsigned(j) }));
+				reg.clear();
+			}
+			}, n);
+		bench::add("registry/construct_existing/" + size, [n](size_t iterations) {
+			element_registry reg;
+			for (size_t j = 0; j < n; ++j)
+				reg.construct(key{ unsigned(j) });
+			for (size_t i = 0; i < iterations; ++i)
+				for (size_t j = 0; j < n; ++j)
+					bench::do_not_optimize(reg.construct(key{ unsigned(j) }));
+			}, n);
+		bench::add("registry/add_destroy/" + size, [n](size_t iterations) {
+			std::vector<element_registry::Handle> handles(n);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				// handles are never reused, so start each iteration with a fresh registry
+				element_registry reg;
+				for (size_t j = 0; j < n; ++j)
+					handles[j] = reg.add(keyed_element(key{ unsigned(j) }));
+				for (element_registry::Handle h : handles)
+					bench::do_not_optimize(reg.destroy(h));
+			}
+			}, n);
+	}
+
+	const bool registered = [] {
+		register_array<64>();
+		register_array<4096>();
+		register_array<262144>();
+		for (size_t len : { size_t(64), size_t(4096), size_t(262144) })
+			register_var_array(len);
+		register_indexing<array<int, 4096>>("array", [] { return array<int, 4096>(7); });
+		register_indexing<var_array<int>>("var_array", [] { return var_array<int>(7, 4096); });
+		register_copy_ptr();
+		for (size_t n : { size_t(100), size_t(10000), size_t(100000) })
+			register_registry(n);
+		return true;
+		}();
+}
@@ -0,0 +1,74 @@
+#include "bench.hpp"
+
+#include "include/functor.hpp"
+
+#include <array>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace mozaic;
+
+namespace
+{
+	constexpr size_t elements = 4096;
+
+	// Invokes the callback once per element, the way per-element callbacks are used in practice. The callable is escaped
+	// first so that the compiler cannot see through the type erasure and inline the target.
+	template<typename Wrapper, typename F>
+	void register_call(const std::string& name, F f)
+	{
+		bench::add("functor/call/" + name, [f](size_t iterations) {
+			std::vector<int> data(elements);
+			bench::xorshift rng;
+			for (int& v : data)
+				v = int(rng() & 0xFFFF);
+			Wrapper callback(f);
+			bench::do_not_optimize(callback);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				long long sum = 0;
+				for (int v : data)
+					sum += callback(v);
+				bench::do_not_optimize(sum);
+			}
+			}, elements);
+	}
+
+	template<typename Wrapper, typename F>
+	void register_construct(const std::string& name, F f)
+	{
+		bench::add("functor/construct/" + name, [f](size_t iterations) {
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				Wrapper wrapper(f);
+				bench::do_not_optimize(wrapper);
+			}
+			});
+	}
+
+	template<typename F>
+	void register_capture(const std::string& capture, F f)
+	{
+		using sig = int(int);
+		register_call<F>("direct/" + capture, f);
+		register_call<function_ref<sig>>("function_ref/" + capture, f);
+		register_call<inplace_function<sig, 64>>("inplace_function/" + capture, f);
+		register_call<unique_function<sig>>("unique_function/" + capture, f);
+		register_call<std::function<sig>>("std_function/" + capture, f);
+
+		register_construct<function_ref<sig>>("function_ref/" + capture, f);
+		register_construct<inplace_function<sig, 64>>("inplace_function/" + capture, f);
+		register_construct<unique_function<sig>>("unique_function/" + capture, f);
+		register_construct<std::function<sig>>("std_function/" + capture, f);
+	}
+
+	const bool registered = [] {
+		// fits every wrapper's inline storage
+		register_capture("small", [bias = 3](int v) { return 3 * v + bias; });
+		// 48 bytes: beyond the small-buffer size of std::function and unique_function, so both allocate
+		std::array<int, 12> table = { 1, 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31 };
+		register_capture("large", [table](int v) { return v * table[v & 7] + table[11]; });
+		return true;
+		}();
+}
@@ -0,0 +1,205 @@
+#include "bench.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+// Usage: mozaic_bench [--quick] [--filter <substring>] [--out <file.json>] [--list] [--help]
+// Results are written as JSON (stdout by default), in registration order, so that runs from two commits can be diffed
+// directly or with bench/compare.py. A human-readable table goes to stderr.
+
+namespace
+{
+	using clock_type = std::chrono::steady_clock;
+
+	struct options
+	{
+		bool quick = false;
+		bool list = false;
+		bool help = false;
+		std::string filter;
+		std::string out;
+		double min_sample_ns = 20e6;
+		size_t samples = 15;
+	};
+
+	struct result
+	{
+		const mozaic::bench::benchmark* bench;
+		size_t iterations;
+		double min_ns;
+		double median_ns;
+		double mean_ns;
+	};
+
+	double time_ns(const mozaic::bench::benchmark& b, size_t iterations)
+	{
+		auto start = clock_type::now();
+		b.body(iterations);
+		auto end = clock_type::now();
+		return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+	}
+
+	result run(const mozaic::bench::benchmark& b, const options& opt)
+	{
+		// warm up, then grow the iteration count until one sample takes at least min_sample_ns
+		time_ns(b, 1);
+		size_t iterations = 1;
+		double t = time_ns(b, iterations);
+		while (t < opt.min_sample_ns && iterations < (size_t(1) << 40))
+		{
+			double factor = t > 0 ? std::min(10.0, std::max(2.0, 1.2 * opt.min_sample_ns / t)) : 10.0;
+			iterations = static_cast<size_t>(static_cast<double>(iterations) * factor);
+			t = time_ns(b, iterations);
+		}
+		std::vector<double> per_op(opt.samples);
+		for (double& sample : per_op)
+			sample = time_ns(b, iterations) / static_cast<double>(iterations);
+		std::sort(per_op.begin(), per_op.end());
+		double mean = 0.0;
+		for (double sample : per_op)
+			mean += sample;
+		mean /= static_cast<double>(per_op.size());
+		return { &b, iterations, per_op.front(), per_op[per_op.size() / 2], mean };
+	}
+
+	std::string json_escape(const std::string& s)
+	{
+		std::string out;
+		for (char c : s)
+		{
+			if (c == '"' || c == '\\')
+				out += '\\';
+			out += c;
+		}
+		return out;
+	}
+
+	std::string number(double v)
+	{
+		char buf[64];
+		std::snprintf(buf, sizeof(buf), "%.3f", v);
+		return buf;
+	}
+
+	std::string compiler()
+	{
+#if defined(__clang__)
+		return "clang " __clang_version__;
+#elif defined(__GNUC__)
+		return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+		return "msvc " + std::to_string(_MSC_VER);
+#else
+		return "unknown";
+#endif
+	}
+
+	void write_json(std::ostream& out, const std::vector<result>& results, const options& opt)
+	{
+		out << "{\n";
+		out << "  \"suite\": \"mozaic\",\n";
+		out << "  \"compiler\": \"" << json_escape(compiler()) << "\",\n";
+#ifdef NDEBUG
+		out << "  \"optimized\": true,\n";
+#else
+		out << "  \"optimized\": false,\n";
+#endif
+		out << "  \"samples\": " << opt.samples << ",\n";
+		out << "  \"results\": [";
+		for (size_t i = 0; i < results.size(); ++i)
+		{
+			const result& r = results[i];
+			out << (i ? ",\n" : "\n") << "    { \"name\": \"" << json_escape(r.bench->name) << "\", \"iterations\": " << r.iterations
+				<< ", \"ns_per_op\": { \"min\": " << number(r.min_ns) << ", \"median\": " << number(r.median_ns) << ", \"mean\": " << number(r.mean_ns) << " }";
+			if (r.bench->items)
+				out << ", \"ns_per_item\": " << number(r.median_ns / static_cast<double>(r.bench->items));
+			if (r.bench->bytes)
+				out << ", \"bytes_per_second\": " << number(static_cast<double>(r.bench->bytes) * 1e9 / r.median_ns);
+			out << " }";
+		}
+		out << "\n  ]\n}\n";
+	}
+
+	void usage(std::ostream& out, const char* program)
+	{
+		out << "usage: " << program << " [--quick] [--filter <substring>] [--out <file.json>] [--list] [--help]\n"
+			"  --quick              short samples, for smoke runs\n"
+			"  --filter <substring> only run benchmarks whose name contains substring\n"
+			"  --out <file.json>    write JSON results to a file instead of stdout\n"
+			"  --list               print benchmark names without running them\n";
+	}
+
+	bool parse(int argc, char** argv, options& opt)
+	{
+		for (int i = 1; i < argc; ++i)
+		{
+			if (std::strcmp(argv[i], "--quick") == 0)
+			{
+				opt.quick = true;
+				opt.min_sample_ns = 1e6;
+				opt.samples = 3;
+			}
+			else if (std::strcmp(argv[i], "--list") == 0)
+				opt.list = true;
+			else if (std::strcmp(argv[i], "--help") == 0 || std::strcmp(argv[i], "-h") == 0)
+				opt.help = true;
+			else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+				opt.filter = argv[++i];
+			else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+				opt.out = argv[++i];
+			else
+			{
+				usage(std::cerr, argv[0]);
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	options opt;
+	if (!parse(argc, argv, opt))
+		return 2;
+	if (opt.help)
+	{
+		usage(std::cout, argv[0]);
+		return 0;
+	}
+
+	std::vector<result> results;
+	for (const mozaic::bench::benchmark& b : mozaic::bench::benchmarks())
+	{
+		if (!opt.filter.empty() && b.name.find(opt.filter) == std::string::npos)
+			continue;
+		if (opt.list)
+		{
+			std::cout << b.name << std::endl;
+			continue;
+		}
+		results.push_back(run(b, opt));
+		const result& r = results.back();
+		std::fprintf(stderr, "%-48s %14.1f ns/op  (min %.1f, %zu iterations)\n", b.name.c_str(), r.median_ns, r.min_ns, r.iterations);
+	}
+	if (opt.list)
+		return 0;
+
+	if (opt.out.empty())
+		write_json(std::cout, results, opt);
+	else
+	{
+		std::ofstream file(opt.out);
+		if (!file)
+		{
+			std::cerr << "cannot write " << opt.out << std::endl;
+			return 1;
+		}
+		write_json(file, results, opt);
+	}
+	return 0;
+}
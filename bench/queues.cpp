@@ -0,0 +1,166 @@
+#include "bench.hpp"
+
+#include "include/queues.hpp"
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace mozaic;
+
+namespace
+{
+	constexpr size_t queue_capacity = 1024;
+	constexpr size_t batch = 64;
+
+	// Moves `iterations` items from one producer thread to one consumer thread, one at a time.
+	template<typename Wait>
+	void register_spsc(const std::string& wait)
+	{
+		bench::add("queues/spsc/single/" + wait, [](size_t iterations) {
+			spsc_ring<size_t, Wait> ring(queue_capacity);
+			std::thread producer([&] {
+				for (size_t i = 0; i < iterations; ++i)
+					ring.push(i);
+				});
+			size_t sum = 0;
+			for (size_t i = 0; i < iterations; ++i)
+				sum += ring.pop();
+			producer.join();
+			bench::do_not_optimize(sum);
+			}, 1, sizeof(size_t));
+		// items are written and read in place through claimed spans, batch at a time
+		bench::add("queues/spsc/batch/" + wait, [](size_t iterations) {
+			spsc_ring<size_t, Wait> ring(queue_capacity);
+			const size_t total = iterations * batch;
+			std::thread producer([&] {
+				var_array<size_t> items(batch, false);
+				for (size_t i = 0; i < total; i += batch)
+				{
+					for (size_t j = 0; j < batch; ++j)
+						items[j] = i + j;
+					ring.push(items.get(), batch);
+				}
+				});
+			var_array<size_t> out(batch, false);
+			size_t sum = 0;
+			for (size_t i = 0; i < total; i += batch)
+			{
+				ring.pop(out.get(), batch);
+				for (size_t j = 0; j < batch; ++j)
+					sum += out[j];
+			}
+			producer.join();
+			bench::do_not_optimize(sum);
+			}, batch, batch * sizeof(size_t));
+	}
+
+	// Round trip of one item through a pair of rings: the latency of a hand-off in each direction.
+	template<typename Wait>
+	void register_ping_pong(const std::string& wait)
+	{
+		bench::add("queues/latency/spsc_round_trip/" + wait, [](size_t iterations) {
+			spsc_ring<size_t, Wait> ping(16), pong(16);
+			std::thread echo([&] {
+				for (size_t i = 0; i < iterations; ++i)
+					pong.push(ping.pop());
+				});
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				ping.push(i);
+				bench::do_not_optimize(pong.pop());
+			}
+			echo.join();
+			});
+	}
+
+	// Splits `iterations` items over the producers; every consumer pops until all items are accounted for.
+	template<typename Queue>
+	void run_many(Queue& queue, size_t iterations, size_t producers, size_t consumers)
+	{
+		std::atomic<size_t> remaining = iterations;
+		std::vector<std::thread> threads;
+		for (size_t p = 0; p < producers; ++p)
+			threads.emplace_back([&, p] {
+				for (size_t i = p; i < iterations; i += producers)
+					queue.push(i);
+				});
+		for (size_t c = 0; c < consumers; ++c)
+			threads.emplace_back([&] {
+				size_t sum = 0, item;
+				while (remaining.load(std::memory_order_relaxed))
+				{
+					if (queue.try_pop(item))
+					{
+						sum += item;
+						remaining.fetch_sub(1, std::memory_order_relaxed);
+					}
+					else
+						std::this_thread::yield();
+				}
+				bench::do_not_optimize(sum);
+				});
+		for (std::thread& t : threads)
+			t.join();
+	}
+
+	// Baseline: the same workload over a mutex-protected std::deque.
+	struct locked_deque
+	{
+		std::mutex mutex;
+		std::deque<size_t> items;
+
+		explicit locked_deque(size_t) {}
+
+		void push(size_t item)
+		{
+			for (;;)
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (items.size() < queue_capacity)
+					{
+						items.push_back(item);
+						return;
+					}
+				}
+				std::this_thread::yield();
+			}
+		}
+		bool try_pop(size_t& item)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (items.empty())
+				return false;
+			item = items.front();
+			items.pop_front();
+			return true;
+		}
+	};
+
+	template<typename Queue>
+	void register_many(const std::string& name, size_t pairs)
+	{
+		const std::string threads = std::to_string(pairs) + "p" + std::to_string(pairs) + "c";
+		bench::add("queues/mpmc/" + threads + "/" + name, [pairs](size_t iterations) {
+			Queue queue(queue_capacity);
+			run_many(queue, iterations, pairs, pairs);
+			}, 1, sizeof(size_t));
+	}
+
+	const bool registered = [] {
+		register_spsc<spin_wait>("spin");
+		register_spsc<blocking_wait>("blocking");
+		register_ping_pong<spin_wait>("spin");
+		register_ping_pong<blocking_wait>("blocking");
+		for (size_t pairs : { 1, 2, 4 })
+		{
+			register_many<mpmc_queue<size_t, spin_wait>>("spin", pairs);
+			register_many<mpmc_queue<size_t, blocking_wait>>("blocking", pairs);
+			register_many<locked_deque>("mutex_deque", pairs);
+		}
+		return true;
+		}();
+}
@@ -0,0 +1,133 @@
+#include "bench.hpp"
+
+#include "include/utf.hpp"
+
+#include <memory>
+#include <string>
+
+using namespace mozaic;
+
+namespace
+{
+	struct corpus
+	{
+		const char* name;
+		// code point ranges sampled uniformly, with the given percentage of ASCII mixed in
+		char32_t lo, hi;
+		unsigned ascii_percent;
+	};
+
+	const corpus corpora[] = {
+		{ "ascii", 0x20, 0x7E, 100 },
+		{ "latin", 0xC0, 0xFF, 90 },
+		{ "cyrillic", 0x410, 0x44F, 15 },
+		{ "cjk", 0x4E00, 0x9FFF, 5 },
+		{ "emoji", 0x1F600, 0x1F64F, 5 },
+		{ "mixed", 0x80, 0x1FFFF, 50 },
+	};
+
+	std::string make_corpus(const corpus& c, size_t bytes)
+	{
+		std::string s;
+		s.reserve(bytes + 4);
+		bench::xorshift rng;
+		unsigned char encoded[4];
+		while (s.size() < bytes)
+		{
+			uint32_t cp = rng() % 100 < c.ascii_percent ? 0x20 + rng() % 0x5F : c.lo + rng() % (c.hi - c.lo + 1);
+			if (cp >= 0xD800 && cp <= 0xDFFF)
+				continue;
+			s.append(reinterpret_cast<const char*>(encoded), utf::__utf::encode(cp, encoded));
+		}
+		return s;
+	}
+
+	const char* isa_name(utf::isa set)
+	{
+		switch (set)
+		{
+		case utf::isa::avx2: return "avx2";
+		case utf::isa::sse4: return "sse4";
+		default: return "scalar";
+		}
+	}
+
+	void register_corpus(const corpus& c, std::shared_ptr<const std::string> text, utf::isa set)
+	{
+		const size_t bytes = text->size();
+		const std::string suffix = std::string("/") + c.name + "/" + isa_name(set);
+		bench::add("utf/validate" + suffix, [=](size_t iterations) {
+			const std::string& s = *text;
+			utf::use_isa(set);
+			for (size_t i = 0; i < iterations; ++i)
+				bench::do_not_optimize(utf::validate_utf8(s.data(), s.size()));
+			utf::use_isa(utf::detected_isa());
+			}, 0, bytes);
+		bench::add("utf/utf16_length" + suffix, [=](size_t iterations) {
+			const std::string& s = *text;
+			utf::use_isa(set);
+			for (size_t i = 0; i < iterations; ++i)
+				bench::do_not_optimize(utf::utf16_length_from_utf8(s.data(), s.size()));
+			utf::use_isa(utf::detected_isa());
+			}, 0, bytes);
+		bench::add("utf/utf8_to_utf16" + suffix, [=](size_t iterations) {
+			const std::string& s = *text;
+			utf::use_isa(set);
+			var_array<char16_t> out(utf::utf16_length_from_utf8(s.data(), s.size()), false);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				bench::do_not_optimize(utf::utf8_to_utf16(s.data(), s.size(), out.get()));
+				bench::clobber_memory();
+			}
+			utf::use_isa(utf::detected_isa());
+			}, 0, bytes);
+		bench::add("utf/utf8_to_utf32" + suffix, [=](size_t iterations) {
+			const std::string& s = *text;
+			utf::use_isa(set);
+			var_array<char32_t> out(utf::count_utf8(s.data(), s.size()), false);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				bench::do_not_optimize(utf::utf8_to_utf32(s.data(), s.size(), out.get()));
+				bench::clobber_memory();
+			}
+			utf::use_isa(utf::detected_isa());
+			}, 0, bytes);
+		bench::add("utf/utf16_to_utf8" + suffix, [=](size_t iterations) {
+			const std::string& s = *text;
+			const var_array<char16_t> src = utf::utf8_to_utf16(s.data(), s.size());
+			utf::use_isa(set);
+			var_array<char> out(s.size(), false);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				bench::do_not_optimize(utf::utf16_to_utf8(src.get(), src.length(), out.get()));
+				bench::clobber_memory();
+			}
+			utf::use_isa(utf::detected_isa());
+			}, 0, bytes);
+		bench::add("utf/stream_utf8_to_utf16" + suffix, [=](size_t iterations) {
+			const std::string& s = *text;
+			utf::use_isa(set);
+			// odd chunk size so that sequences regularly straddle chunk boundaries
+			const size_t chunk = 4093;
+			var_array<char16_t> out(chunk + 3, false);
+			for (size_t i = 0; i < iterations; ++i)
+			{
+				utf::utf8_decoder<char16_t> decoder;
+				for (size_t pos = 0; pos < s.size(); pos += chunk)
+					bench::do_not_optimize(decoder.decode(s.data() + pos, std::min(chunk, s.size() - pos), out.get()));
+				decoder.finish();
+			}
+			utf::use_isa(utf::detected_isa());
+			}, 0, bytes);
+	}
+
+	const bool registered = [] {
+		for (const corpus& c : corpora)
+		{
+			auto text = std::make_shared<const std::string>(make_corpus(c, size_t(1) << 20));
+			for (int set = 0; set <= static_cast<int>(utf::detected_isa()); ++set)
+				register_corpus(c, text, static_cast<utf::isa>(set));
+		}
+		return true;
+		}();
+}
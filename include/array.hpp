@@ -1,15 +1,67 @@
 #pragma once
 
+#include <cstdint>
 #include <stdexcept>
 #include <type_traits>
 #include <string>
 #include <utility>
 
-// TODO add optional index access range checking. could be a wrapper arround array/var_array
+// Per-element bounds checking on operator[] is selected at compile time: on by default unless NDEBUG is defined, and
+// compiled out entirely otherwise. Define MOZAIC_BOUNDS_CHECK to 0 or 1 to override, consistently across the program.
+// at() is always checked, and bulk operations (copy, move, subarray) validate their range once per call in every build.
+#ifndef MOZAIC_BOUNDS_CHECK
+#ifdef NDEBUG
+#define MOZAIC_BOUNDS_CHECK 0
+#else
+#define MOZAIC_BOUNDS_CHECK 1
+#endif
+#endif
+
 namespace mozaic
 {
 	typedef std::make_signed_t<size_t> ssize_t;
 
+	inline constexpr bool bounds_checked = MOZAIC_BOUNDS_CHECK != 0;
+
+	struct out_of_range_error : std::out_of_range
+	{
+		out_of_range_error(size_t index, size_t len) : std::out_of_range("index (" + std::to_string(index) + ") is out of range for array length (" + std::to_string(len) + ")") {}
+		out_of_range_error(size_t pos, size_t count, size_t len) : std::out_of_range("range [" + std::to_string(pos) + ", " + std::to_string(pos) + " + " + std::to_string(count) + ") is out of range for array length (" + std::to_string(len) + ")") {}
+	};
+
+	template<typename T, size_t Len, bool Initialize>
+	class array;
+
+	namespace __arr
+	{
+		template<typename T>
+		struct is_array : std::false_type {};
+		template<typename T, size_t Len, bool Initialize>
+		struct is_array<array<T, Len, Initialize>> : std::true_type {};
+
+		// Selects the element constructor only when T can be built from the arguments. A single array or element argument
+		// goes to the copy/move or fill constructors instead.
+		template<typename T, typename... Args>
+		inline constexpr bool constructs_elements = std::is_constructible_v<T, Args...> && (sizeof...(Args) != 1
+			|| !(is_array<std::decay_t<Args>>::value || ...) && !(std::is_same_v<std::decay_t<Args>, T> || ...));
+
+		// Kept out of line so that the check in operator[] stays a compare and a not-taken branch.
+		[[noreturn]] inline void throw_out_of_range(size_t index, size_t len)
+		{
+			throw out_of_range_error(index, len);
+		}
+		inline void check_index(size_t index, size_t len)
+		{
+			if (index >= len)
+				throw_out_of_range(index, len);
+		}
+		inline void check_range(size_t pos, size_t count, size_t len)
+		{
+			if (count > len || pos > len - count)
+				throw out_of_range_error(pos, count, len);
+		}
+	}
+
 	// TODO polymorphic subtypes
 	template<typename T, size_t Len, bool Initialize = true>
 	class array
@@ -24,7 +76,11 @@ namespace mozaic
 		~array();
 		explicit array(T* raw_heap_array, size_t len);
 		explicit array(const T& val);
-		template<typename... Args> explicit array(Args&&... args);
+		template<typename... Args, typename = std::enable_if_t<__arr::constructs_elements<T, Args...>>> explicit array(Args&&... args);
+		array(const array<T, Len, Initialize>& other);
+		array(array<T, Len, Initialize>&& other) noexcept;
+		array& operator=(const array<T, Len, Initialize>& other) { return operator=<Initialize>(other); }
+		array& operator=(array<T, Len, Initialize>&& other) noexcept { return operator=<Initialize>(std::move(other)); }
 		template<bool I> array(const array<T, Len, I>& other);
 		template<bool I> array(array<T, Len, I>&& other) noexcept;
 		template<bool I> array& operator=(const array<T, Len, I>& other);
@@ -33,8 +89,10 @@ namespace mozaic
 		T* get() { return _arr; }
 		const T* get() const { return _arr; }
 		constexpr size_t length() const { return Len; }
-		T& operator[](size_t i) { return _arr[i]; }
-		const T& operator[](size_t i) const { return _arr[i]; }
+		T& operator[](size_t i);
+		const T& operator[](size_t i) const;
+		T& at(size_t i);
+		const T& at(size_t i) const;
 		void copy(size_t pos, T* arr, size_t len);
 		void move(size_t pos, T* arr, size_t len);
 		template<size_t SubLen, bool SubInit = Initialize> array<T, SubLen, SubInit> subarray(size_t pos) const;
@@ -67,15 +125,29 @@ namespace mozaic
 		_arr = raw_heap_array;
 	}
 	template<typename T, size_t Len, bool Initialize>
-	inline array<T, Len, Initialize>::array(const T& val) : _arr(new T[Len](val))
+	inline array<T, Len, Initialize>::array(const T& val) : _arr(new T[Len])
 	{
 		static_assert(Initialize, "Cannot initialize non-initializing array.");
+		for (size_t i = 0; i < Len; ++i)
+			_arr[i] = val;
 	}
 	template<typename T, size_t Len, bool Initialize>
-	template<typename ...Args>
-	inline array<T, Len, Initialize>::array(Args && ...args)
+	template<typename... Args, typename>
+	inline array<T, Len, Initialize>::array(Args&&... args) : _arr(new T[Len])
 	{
-		_arr = new T[Len](std::forward<Args>(args)...);
+		for (size_t i = 0; i < Len; ++i)
+			_arr[i] = T(args...);
+	}
+	template<typename T, size_t Len, bool Initialize>
+	inline array<T, Len, Initialize>::array(const array<T, Len, Initialize>& other) : _arr(new T[Len])
+	{
+		for (size_t i = 0; i < Len; ++i)
+			new (_arr + i) T(other._arr[i]);
+	}
+	template<typename T, size_t Len, bool Initialize>
+	inline array<T, Len, Initialize>::array(array<T, Len, Initialize>&& other) noexcept : _arr(other._arr)
+	{
+		other._arr = nullptr;
 	}
 	template<typename T, size_t Len, bool Initialize>
 	template<bool I>
@@ -114,25 +186,53 @@ namespace mozaic
 		return *this;
 	}
 	template<typename T, size_t Len, bool Initialize>
+	inline T& array<T, Len, Initialize>::operator[](size_t i)
+	{
+		if constexpr (bounds_checked)
+			__arr::check_index(i, Len);
+		return _arr[i];
+	}
+	template<typename T, size_t Len, bool Initialize>
+	inline const T& array<T, Len, Initialize>::operator[](size_t i) const
+	{
+		if constexpr (bounds_checked)
+			__arr::check_index(i, Len);
+		return _arr[i];
+	}
+	template<typename T, size_t Len, bool Initialize>
+	inline T& array<T, Len, Initialize>::at(size_t i)
+	{
+		__arr::check_index(i, Len);
+		return _arr[i];
+	}
+	template<typename T, size_t Len, bool Initialize>
+	inline const T& array<T, Len, Initialize>::at(size_t i) const
+	{
+		__arr::check_index(i, Len);
+		return _arr[i];
+	}
+	template<typename T, size_t Len, bool Initialize>
 	inline void array<T, Len, Initialize>::copy(size_t pos, T* arr, size_t len)
 	{
-		if (pos + len > Len)
-			throw bad_length_error(pos + len);
-		for (size_t i = pos; i < Len; ++i)
-			_arr[i] = arr[i];
+		__arr::check_range(pos, len, Len);
+		T* dst = _arr + pos;
+		for (size_t i = 0; i < len; ++i)
+			dst[i] = arr[i];
 	}
 	template<typename T, size_t Len, bool Initialize>
 	inline void array<T, Len, Initialize>::move(size_t pos, T* arr, size_t len)
 	{
-		if (pos + len > Len)
-			throw bad_length_error(pos + len);
-		for (size_t i = pos; i < Len; ++i)
-			_arr[i] = std::move(arr[i]);
+		__arr::check_range(pos, len, Len);
+		T* dst = _arr + pos;
+		for (size_t i = 0; i < len; ++i)
+			dst[i] = std::move(arr[i]);
 	}
 	template<typename T, size_t Len, bool Initialize>
 	template<size_t SubLen, bool SubInit>
 	inline array<T, SubLen, SubInit> array<T, Len, Initialize>::subarray(size_t pos) const
 	{
+		static_assert(SubLen <= Len, "subarray cannot be longer than array.");
+		__arr::check_range(pos, SubLen, Len);
 		array<T, SubLen, SubInit> sub;
 		sub.copy(0, _arr + pos, SubLen);
 		return sub;
@@ -168,8 +268,10 @@ namespace mozaic
 		T* get() { return _arr; }
 		const T* get() const { return _arr; }
 		size_t length() const { return _len; }
-		T& operator[](size_t i) { return _arr[i]; }
-		const T& operator[](size_t i) const { return _arr[i]; }
+		T& operator[](size_t i);
+		const T& operator[](size_t i) const;
+		T& at(size_t i);
+		const T& at(size_t i) const;
 		template<bool GrowToFit = false> void copy(size_t pos, T* arr, size_t len);
 		template<bool GrowToFit = false> void move(size_t pos, T* arr, size_t len);
 		void resize(size_t len, bool initialize = true);
@@ -191,8 +293,10 @@ namespace mozaic
 	{
 	}
 	template<typename T>
-	inline var_array<T>::var_array(const T& val, size_t len) : _arr(new T[len](val)), _len(len)
+	inline var_array<T>::var_array(const T& val, size_t len) : _arr(new T[len]), _len(len)
 	{
+		for (size_t i = 0; i < _len; ++i)
+			_arr[i] = val;
 	}
 	template<typename T>
 	inline var_array<T>::var_array(const var_array<T>& other) : _arr(new T[other._len]), _len(other._len)
@@ -244,64 +348,84 @@ namespace mozaic
 		return *this;
 	}
 	template<typename T>
+	inline T& var_array<T>::operator[](size_t i)
+	{
+		if constexpr (bounds_checked)
+			__arr::check_index(i, _len);
+		return _arr[i];
+	}
+	template<typename T>
+	inline const T& var_array<T>::operator[](size_t i) const
+	{
+		if constexpr (bounds_checked)
+			__arr::check_index(i, _len);
+		return _arr[i];
+	}
+	template<typename T>
+	inline T& var_array<T>::at(size_t i)
+	{
+		__arr::check_index(i, _len);
+		return _arr[i];
+	}
+	template<typename T>
+	inline const T& var_array<T>::at(size_t i) const
+	{
+		__arr::check_index(i, _len);
+		return _arr[i];
+	}
+	template<typename T>
 	template<bool GrowToFit>
 	inline void var_array<T>::copy(size_t pos, T* arr, size_t len)
 	{
-		len += pos;
 		if constexpr (GrowToFit)
 		{
-			if (len <= _len)
+			if (len > _len || pos > _len - len)
 			{
-				for (size_t i = pos; i < len; ++i)
-					_arr[i] = arr[i];
-			}
-			else
-			{
-				T* temp = new T[len];
-				for (size_t i = 0; i < pos; ++i)
+				if (pos > SIZE_MAX - len)
+					throw out_of_range_error(pos, len, SIZE_MAX);
+				T* temp = new T[pos + len];
+				for (size_t i = 0; i < pos && i < _len; ++i)
 					temp[i] = std::move(_arr[i]);
-				for (size_t i = pos; i < len; ++i)
-					temp[i] = arr[i];
+				for (size_t i = 0; i < len; ++i)
+					temp[pos + i] = arr[i];
 				delete[] _arr;
 				_arr = temp;
-				_len = len;
+				_len = pos + len;
+				return;
 			}
 		}
 		else
-		{
-			for (size_t i = pos; i < _len && len; ++i)
-				_arr[i] = arr[i];
-		}
+			__arr::check_range(pos, len, _len);
+		T* dst = _arr + pos;
+		for (size_t i = 0; i < len; ++i)
+			dst[i] = arr[i];
 	}
 	template<typename T>
 	template<bool GrowToFit>
 	inline void var_array<T>::move(size_t pos, T* arr, size_t len)
 	{
-		len += pos;
 		if constexpr (GrowToFit)
 		{
-			if (len <= _len)
-			{
-				for (size_t i = pos; i < len; ++i)
-					_arr[i] = arr[i];
-			}
-			else
+			if (len > _len || pos > _len - len)
 			{
-				T* temp = new T[len];
-				for (size_t i = 0; i < pos; ++i)
+				if (pos > SIZE_MAX - len)
+					throw out_of_range_error(pos, len, SIZE_MAX);
+				T* temp = new T[pos + len];
+				for (size_t i = 0; i < pos && i < _len; ++i)
 					temp[i] = std::move(_arr[i]);
-				for (size_t i = pos; i < len; ++i)
-					temp[i] = std::move(arr[i]);
+				for (size_t i = 0; i < len; ++i)
+					temp[pos + i] = std::move(arr[i]);
 				delete[] _arr;
 				_arr = temp;
-				_len = len;
+				_len = pos + len;
+				return;
 			}
 		}
 		else
-		{
-			for (size_t i = pos; i < _len && len; ++i)
-				_arr[i] = std::move(arr[i]);
-		}
+			__arr::check_range(pos, len, _len);
+		T* dst = _arr + pos;
+		for (size_t i = 0; i < len; ++i)
+			dst[i] = std::move(arr[i]);
 	}
 	template<typename T>
 	inline void var_array<T>::resize(size_t len, bool initialize)
@@ -333,13 +457,11 @@ namespace mozaic
 	template<typename T>
 	inline var_array<T> var_array<T>::subarray(size_t pos, size_t len) const
 	{
-		if (pos > _len)
-			return var_array<T>(nullptr, 0);
-		if (pos + len > _len)
-			len = _len - pos;
+		__arr::check_range(pos, len, _len);
 		T* arr = new T[len];
+		const T* src = _arr + pos;
 		for (size_t i = 0; i < len; ++i)
-			arr[i] = _arr[pos + i];
+			arr[i] = src[i];
 		return var_array<T>(arr, len);
 	}
 	template<typename T>
@@ -0,0 +1,381 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+#include "array.hpp"
+
+namespace mozaic
+{
+	// Ranges are inclusive on both ends. Row 0 is the bottom row of the buffer.
+	struct horizontal_line
+	{
+		size_t y = 0;
+		size_t x0 = 0, x1 = 0;
+	};
+
+	struct vertical_line
+	{
+		size_t x = 0;
+		size_t y0 = 0, y1 = 0;
+	};
+
+	struct upright_rect
+	{
+		size_t x0 = 0, x1 = 0;
+		size_t y0 = 0, y1 = 0;
+
+		size_t width() const { return x1 - x0 + 1; }
+		size_t height() const { return y1 - y0 + 1; }
+		size_t area() const { return width() * height(); }
+		bool contains(const upright_rect& other) const { return x0 <= other.x0 && other.x1 <= x1 && y0 <= other.y0 && other.y1 <= y1; }
+		bool touches(const upright_rect& other) const { return x0 <= other.x1 + 1 && other.x0 <= x1 + 1 && y0 <= other.y1 + 1 && other.y0 <= y1 + 1; }
+		upright_rect merged(const upright_rect& other) const { return { std::min(x0, other.x0), std::max(x1, other.x1), std::min(y0, other.y0), std::max(y1, other.y1) }; }
+		bool operator==(const upright_rect& other) const { return x0 == other.x0 && x1 == other.x1 && y0 == other.y0 && y1 == other.y1; }
+	};
+
+	// Coalescing set of damaged rects. Touching rects are merged into their bounding box, and once max_rects is reached,
+	// new rects are merged into whichever existing rect grows the least.
+	class dirty_region
+	{
+		std::vector<upright_rect> _rects;
+		size_t _max_rects;
+
+	public:
+		explicit dirty_region(size_t max_rects = 16) : _max_rects(max_rects > 0 ? max_rects : 1) {}
+
+		const std::vector<upright_rect>& rects() const { return _rects; }
+		bool empty() const { return _rects.empty(); }
+		void clear() { _rects.clear(); }
+		size_t max_rects() const { return _max_rects; }
+		void add(upright_rect rect);
+		upright_rect bounds() const;
+		size_t area() const;
+		var_array<bool> tiles(size_t width, size_t height, size_t tile_width, size_t tile_height) const;
+	};
+	inline void dirty_region::add(upright_rect rect)
+	{
+		bool merged = true;
+		while (merged)
+		{
+			merged = false;
+			for (size_t i = 0; i < _rects.size(); ++i)
+			{
+				if (_rects[i].contains(rect))
+					return;
+				if (_rects[i].touches(rect))
+				{
+					rect = rect.merged(_rects[i]);
+					_rects[i] = _rects.back();
+					_rects.pop_back();
+					merged = true;
+					break;
+				}
+			}
+		}
+		if (_rects.size() < _max_rects)
+		{
+			_rects.push_back(rect);
+			return;
+		}
+		size_t best = 0;
+		size_t best_growth = size_t(-1);
+		for (size_t i = 0; i < _rects.size(); ++i)
+		{
+			size_t growth = _rects[i].merged(rect).area() - _rects[i].area();
+			if (growth < best_growth)
+			{
+				best = i;
+				best_growth = growth;
+			}
+		}
+		rect = rect.merged(_rects[best]);
+		_rects[best] = _rects.back();
+		_rects.pop_back();
+		add(rect);
+	}
+	inline upright_rect dirty_region::bounds() const
+	{
+		if (_rects.empty())
+			return {};
+		upright_rect b = _rects[0];
+		for (size_t i = 1; i < _rects.size(); ++i)
+			b = b.merged(_rects[i]);
+		return b;
+	}
+	inline size_t dirty_region::area() const
+	{
+		// rects are disjoint after coalescing, since overlapping rects touch
+		size_t a = 0;
+		for (const upright_rect& rect : _rects)
+			a += rect.area();
+		return a;
+	}
+	// Returns a row-major bitmap of ceil(width / tile_width) * ceil(height / tile_height) tiles, where a tile is set if any of its pixels are dirty.
+	inline var_array<bool> dirty_region::tiles(size_t width, size_t height, size_t tile_width, size_t tile_height) const
+	{
+		if (tile_width == 0 || tile_height == 0)
+			return var_array<bool>();
+		size_t cols = (width + tile_width - 1) / tile_width;
+		size_t rows = (height + tile_height - 1) / tile_height;
+		var_array<bool> bits(cols * rows);
+		for (const upright_rect& rect : _rects)
+		{
+			if (rect.x0 >= width || rect.y0 >= height)
+				continue;
+			size_t c1 = std::min(rect.x1, width - 1) / tile_width;
+			size_t r1 = std::min(rect.y1, height - 1) / tile_height;
+			for (size_t r = rect.y0 / tile_height; r <= r1; ++r)
+				for (size_t c = rect.x0 / tile_width; c <= c1; ++c)
+					bits[r * cols + c] = true;
+		}
+		return bits;
+	}
+
+	// Keeps memory that a buffer2d views in place alive, such as a file mapping. The buffer deletes its owner on release.
+	struct buffer_owner
+	{
+		virtual ~buffer_owner() = default;
+		// Writes changes made through the view back to their backing store, if there is one.
+		virtual void flush() {}
+	};
+
+	class buffer2d
+	{
+		std::byte* _buf = nullptr;
+		buffer_owner* _owner = nullptr;
+		size_t _width = 0;
+		size_t _height = 0;
+		size_t _chpp = 0;
+		bool _track_damage = false;
+		dirty_region _damage;
+
+	public:
+		buffer2d() = default;
+		explicit buffer2d(std::byte* raw_heap_buffer, size_t width, size_t height, size_t chpp);
+		buffer2d(size_t width, size_t height, size_t chpp, bool initialize = true);
+		// Views pixels in place, taking ownership of owner, which must keep them alive. Copies of a mapped buffer are heap-allocated.
+		explicit buffer2d(std::byte* pixels, buffer_owner* owner, size_t width, size_t height, size_t chpp);
+		buffer2d(const buffer2d& other);
+		buffer2d(buffer2d&& other) noexcept;
+		buffer2d& operator=(const buffer2d& other);
+		buffer2d& operator=(buffer2d&& other) noexcept;
+		~buffer2d();
+
+		operator bool() const { return static_cast<bool>(_buf); }
+		std::byte* buffer() { return _buf; }
+		const std::byte* buffer() const { return _buf; }
+		size_t width() const { return _width; }
+		size_t height() const { return _height; }
+		size_t chpp() const { return _chpp; }
+		size_t stride() const { return _width * _chpp; }
+		size_t bytes() const { return _width * _height * _chpp; }
+		bool mapped() const { return static_cast<bool>(_owner); }
+		void flush() { if (_owner) _owner->flush(); }
+		std::byte* pixel(size_t x, size_t y) { return _buf + y * stride() + x * _chpp; }
+		const std::byte* pixel(size_t x, size_t y) const { return _buf + y * stride() + x * _chpp; }
+
+		void flip_vertically();
+		void flip_horizontally();
+		void set(const std::byte* pixel, const horizontal_line& line);
+		void set(const std::byte* pixel, const vertical_line& line);
+		void set(const std::byte* pixel, const upright_rect& rect);
+		void swap(buffer2d& other) noexcept;
+
+		// Starts or stops recording damage, discarding what was recorded. Copy and move construction and swaps carry the
+		// setting and the recorded damage along with the pixels. Assignment keeps the destination's setting and, like the
+		// other whole-buffer writes, replaces its damage with the full extent.
+		void track_damage(bool track, size_t max_rects = 16);
+		bool tracking_damage() const { return _track_damage; }
+		// Records a write done through buffer() or pixel(). No-op if damage tracking is off.
+		void mark_dirty(const upright_rect& rect);
+		const dirty_region& damage() const { return _damage; }
+		void clear_damage() { _damage.clear(); }
+		var_array<bool> damaged_tiles(size_t tile_width, size_t tile_height) const { return _damage.tiles(_width, _height, tile_width, tile_height); }
+
+	private:
+		void release() noexcept;
+		bool clip(upright_rect& rect) const;
+		void mark_replaced();
+		void fill_row(const std::byte* pixel, size_t y, size_t x0, size_t x1);
+	};
+	inline buffer2d::buffer2d(std::byte* raw_heap_buffer, size_t width, size_t height, size_t chpp)
+		: _buf(raw_heap_buffer), _width(width), _height(height), _chpp(chpp)
+	{
+	}
+	inline buffer2d::buffer2d(size_t width, size_t height, size_t chpp, bool initialize)
+		: _buf(initialize ? new std::byte[width * height * chpp]() : new std::byte[width * height * chpp]), _width(width), _height(height), _chpp(chpp)
+	{
+	}
+	inline buffer2d::buffer2d(std::byte* pixels, buffer_owner* owner, size_t width, size_t height, size_t chpp)
+		: _buf(pixels), _owner(owner), _width(width), _height(height), _chpp(chpp)
+	{
+	}
+	inline buffer2d::buffer2d(const buffer2d& other)
+		: _buf(new std::byte[other.bytes()]), _width(other._width), _height(other._height), _chpp(other._chpp), _track_damage(other._track_damage), _damage(other._damage)
+	{
+		if (bytes())
+			std::memcpy(_buf, other._buf, bytes());
+	}
+	inline buffer2d::buffer2d(buffer2d&& other) noexcept
+		: _buf(other._buf), _owner(other._owner), _width(other._width), _height(other._height), _chpp(other._chpp), _track_damage(other._track_damage), _damage(std::move(other._damage))
+	{
+		other._buf = nullptr;
+		other._owner = nullptr;
+		other._width = 0;
+		other._height = 0;
+		other._chpp = 0;
+		other._damage.clear();
+	}
+	inline buffer2d& buffer2d::operator=(const buffer2d& other)
+	{
+		if (_buf != other._buf)
+		{
+			if (bytes() != other.bytes())
+			{
+				release();
+				_buf = new std::byte[other.bytes()];
+			}
+			_width = other._width;
+			_height = other._height;
+			_chpp = other._chpp;
+			if (bytes())
+				std::memcpy(_buf, other._buf, bytes());
+			mark_replaced();
+		}
+		return *this;
+	}
+	inline buffer2d& buffer2d::operator=(buffer2d&& other) noexcept
+	{
+		if (_buf != other._buf)
+		{
+			release();
+			_buf = other._buf;
+			_owner = other._owner;
+			_width = other._width;
+			_height = other._height;
+			_chpp = other._chpp;
+			other._buf = nullptr;
+			other._owner = nullptr;
+			other._width = 0;
+			other._height = 0;
+			other._chpp = 0;
+			other._damage.clear();
+			mark_replaced();
+		}
+		return *this;
+	}
+	inline buffer2d::~buffer2d()
+	{
+		release();
+	}
+	inline void buffer2d::flip_vertically()
+	{
+		size_t s = stride();
+		for (size_t y = 0; y < _height / 2; ++y)
+			std::swap_ranges(_buf + y * s, _buf + (y + 1) * s, _buf + (_height - 1 - y) * s);
+		if (_height > 1)
+			mark_dirty({ 0, _width - 1, 0, _height - 1 });
+	}
+	inline void buffer2d::flip_horizontally()
+	{
+		size_t s = stride();
+		for (size_t y = 0; y < _height; ++y)
+		{
+			std::byte* row = _buf + y * s;
+			for (size_t x = 0; x < _width / 2; ++x)
+				std::swap_ranges(row + x * _chpp, row + (x + 1) * _chpp, row + (_width - 1 - x) * _chpp);
+		}
+		if (_width > 1)
+			mark_dirty({ 0, _width - 1, 0, _height - 1 });
+	}
+	inline void buffer2d::set(const std::byte* pixel, const horizontal_line& line)
+	{
+		set(pixel, upright_rect{ line.x0, line.x1, line.y, line.y });
+	}
+	inline void buffer2d::set(const std::byte* pixel, const vertical_line& line)
+	{
+		set(pixel, upright_rect{ line.x, line.x, line.y0, line.y1 });
+	}
+	inline void buffer2d::set(const std::byte* pixel, const upright_rect& rect)
+	{
+		upright_rect r = rect;
+		if (!clip(r))
+			return;
+		for (size_t y = r.y0; y <= r.y1; ++y)
+			fill_row(pixel, y, r.x0, r.x1);
+		if (_track_damage)
+			_damage.add(r);
+	}
+	inline void buffer2d::swap(buffer2d& other) noexcept
+	{
+		std::swap(_buf, other._buf);
+		std::swap(_owner, other._owner);
+		std::swap(_width, other._width);
+		std::swap(_height, other._height);
+		std::swap(_chpp, other._chpp);
+		std::swap(_track_damage, other._track_damage);
+		std::swap(_damage, other._damage);
+	}
+	inline void buffer2d::track_damage(bool track, size_t max_rects)
+	{
+		_track_damage = track;
+		_damage = dirty_region(max_rects);
+	}
+	inline void buffer2d::mark_dirty(const upright_rect& rect)
+	{
+		if (!_track_damage)
+			return;
+		upright_rect r = rect;
+		if (clip(r))
+			_damage.add(r);
+	}
+	inline void buffer2d::mark_replaced()
+	{
+		_damage.clear();
+		if (_width && _height)
+			mark_dirty({ 0, _width - 1, 0, _height - 1 });
+	}
+	inline void buffer2d::release() noexcept
+	{
+		if (_owner)
+			delete _owner;
+		else
+			delete[] _buf;
+		_buf = nullptr;
+		_owner = nullptr;
+	}
+	inline bool buffer2d::clip(upright_rect& rect) const
+	{
+		if (rect.x0 > rect.x1)
+			std::swap(rect.x0, rect.x1);
+		if (rect.y0 > rect.y1)
+			std::swap(rect.y0, rect.y1);
+		if (rect.x0 >= _width || rect.y0 >= _height)
+			return false;
+		rect.x1 = std::min(rect.x1, _width - 1);
+		rect.y1 = std::min(rect.y1, _height - 1);
+		return true;
+	}
+	inline void buffer2d::fill_row(const std::byte* pixel, size_t y, size_t x0, size_t x1)
+	{
+		std::byte* row = _buf + y * stride();
+		if (_chpp == 1)
+			std::memset(row + x0, static_cast<int>(*pixel), x1 - x0 + 1);
+		else
+		{
+			for (size_t x = x0; x <= x1; ++x)
+				std::memcpy(row + x * _chpp, pixel, _chpp);
+		}
+	}
+}
+
+namespace std
+{
+	inline void swap(mozaic::buffer2d& a, mozaic::buffer2d& b) noexcept
+	{
+		a.swap(b);
+	}
+}
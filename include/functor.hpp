@@ -1 +1,349 @@
 #pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace mozaic
+{
+	namespace __fn
+	{
+		template<typename R, typename F, typename... Args>
+		inline R invoke(F& f, Args&&... args)
+		{
+			if constexpr (std::is_void_v<R>)
+				std::invoke(f, std::forward<Args>(args)...);
+			else
+				return std::invoke(f, std::forward<Args>(args)...);
+		}
+
+		template<typename F>
+		inline bool is_null(const F& f)
+		{
+			if constexpr (std::is_pointer_v<F> || std::is_member_pointer_v<F>)
+				return f == nullptr;
+			else
+				return false;
+		}
+
+		// Storage management shared by the owning wrappers, which keep the call thunk itself inline to save a load per call.
+		// copy is null for move-only storage, and move both move-constructs into dst and destroys src.
+		struct vtable
+		{
+			void(*copy)(void* dst, const void* src);
+			void(*move)(void* dst, void* src) noexcept;
+			void(*destroy)(void* storage) noexcept;
+		};
+
+		template<typename R, typename... Args>
+		struct empty
+		{
+			static R call(void*, Args&&...) { throw std::bad_function_call(); }
+			static void copy(void*, const void*) {}
+			static void move(void*, void*) noexcept {}
+			static void destroy(void*) noexcept {}
+			static constexpr vtable table{ copy, move, destroy };
+		};
+
+		// Callable constructed directly in the wrapper's storage.
+		template<typename F, typename R, typename... Args>
+		struct local
+		{
+			static R call(void* s, Args&&... args) { return invoke<R>(*static_cast<F*>(s), std::forward<Args>(args)...); }
+			static void copy(void* dst, const void* src) { new (dst) F(*static_cast<const F*>(src)); }
+			static void move(void* dst, void* src) noexcept
+			{
+				new (dst) F(std::move(*static_cast<F*>(src)));
+				static_cast<F*>(src)->~F();
+			}
+			static void destroy(void* s) noexcept { static_cast<F*>(s)->~F(); }
+			static constexpr vtable copyable{ copy, move, destroy };
+			static constexpr vtable movable{ nullptr, move, destroy };
+		};
+
+		// Callable on the heap, with the wrapper's storage holding the pointer.
+		template<typename F, typename R, typename... Args>
+		struct remote
+		{
+			static F* get(void* s) { return *static_cast<F**>(s); }
+			static R call(void* s, Args&&... args) { return invoke<R>(*get(s), std::forward<Args>(args)...); }
+			static void move(void* dst, void* src) noexcept { new (dst) F*(get(src)); }
+			static void destroy(void* s) noexcept { delete get(s); }
+			static constexpr vtable movable{ nullptr, move, destroy };
+		};
+
+		template<typename Wrapper, typename F, typename R, typename... Args>
+		static constexpr bool accepts_v = !std::is_same_v<std::decay_t<F>, Wrapper> && std::is_invocable_r_v<R, std::decay_t<F>&, Args...>;
+	}
+
+	template<typename Sig>
+	class function_ref;
+
+	// Non-owning view of a callable: one pointer to the callable and one to a call thunk. The callable must outlive the
+	// function_ref, so use it for parameters rather than storage.
+	template<typename R, typename... Args>
+	class function_ref<R(Args...)>
+	{
+		union
+		{
+			void* _obj;
+			void(*_fn)();
+		};
+		R(*_call)(const function_ref&, Args&&...);
+
+	public:
+		template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, function_ref> && std::is_invocable_r_v<R, F&, Args...>>>
+		function_ref(F&& f) noexcept;
+		function_ref(const function_ref&) = default;
+		function_ref& operator=(const function_ref&) = default;
+		R operator()(Args... args) const { return _call(*this, std::forward<Args>(args)...); }
+	};
+	template<typename R, typename... Args>
+	template<typename F, typename>
+	inline function_ref<R(Args...)>::function_ref(F&& f) noexcept
+	{
+		using T = std::remove_reference_t<F>;
+		if constexpr (std::is_function_v<T> || std::is_pointer_v<T>)
+		{
+			using P = std::conditional_t<std::is_function_v<T>, T*, std::remove_cv_t<T>>;
+			_fn = reinterpret_cast<void(*)()>(static_cast<P>(f));
+			_call = [](const function_ref& self, Args&&... args) -> R { return __fn::invoke<R>(*reinterpret_cast<P>(self._fn), std::forward<Args>(args)...); };
+		}
+		else
+		{
+			_obj = const_cast<void*>(static_cast<const void*>(std::addressof(f)));
+			_call = [](const function_ref& self, Args&&... args) -> R { return __fn::invoke<R>(*static_cast<T*>(self._obj), std::forward<Args>(args)...); };
+		}
+	}
+
+	template<typename Sig, size_t Capacity = 32, size_t Align = alignof(std::max_align_t)>
+	class inplace_function;
+
+	// Owning, copyable callable stored in a fixed buffer. Never allocates: callables larger than Capacity fail to compile.
+	template<typename R, typename... Args, size_t Capacity, size_t Align>
+	class inplace_function<R(Args...), Capacity, Align>
+	{
+		using empty = __fn::empty<R, Args...>;
+
+		alignas(Align) mutable unsigned char _storage[Capacity];
+		R(*_call)(void*, Args&&...) = empty::call;
+		const __fn::vtable* _vt = &empty::table;
+
+	public:
+		inplace_function() = default;
+		inplace_function(std::nullptr_t) {}
+		~inplace_function() { _vt->destroy(_storage); }
+		template<typename F, typename = std::enable_if_t<__fn::accepts_v<inplace_function, F, R, Args...>>> inplace_function(F&& f);
+		inplace_function(const inplace_function& other);
+		inplace_function(inplace_function&& other) noexcept;
+		inplace_function& operator=(const inplace_function& other);
+		inplace_function& operator=(inplace_function&& other) noexcept;
+		inplace_function& operator=(std::nullptr_t) noexcept;
+		template<typename F, typename = std::enable_if_t<__fn::accepts_v<inplace_function, F, R, Args...>>> inplace_function& operator=(F&& f);
+		R operator()(Args... args) const { return _call(_storage, std::forward<Args>(args)...); }
+		operator bool() const { return _call != empty::call; }
+		void swap(inplace_function& other) noexcept;
+	};
+	template<typename R, typename... Args, size_t Capacity, size_t Align>
+	template<typename F, typename>
+	inline inplace_function<R(Args...), Capacity, Align>::inplace_function(F&& f)
+	{
+		using D = std::decay_t<F>;
+		static_assert(sizeof(D) <= Capacity, "inplace_function capacity is too small for callable.");
+		static_assert(Align % alignof(D) == 0, "inplace_function alignment is incompatible with callable.");
+		static_assert(std::is_copy_constructible_v<D>, "inplace_function requires a copyable callable.");
+		static_assert(std::is_nothrow_move_constructible_v<D>, "inplace_function requires a callable with a non-throwing move constructor.");
+		if (!__fn::is_null(f))
+		{
+			new (_storage) D(std::forward<F>(f));
+			_call = __fn::local<D, R, Args...>::call;
+			_vt = &__fn::local<D, R, Args...>::copyable;
+		}
+	}
+	template<typename R, typename... Args, size_t Capacity, size_t Align>
+	inline inplace_function<R(Args...), Capacity, Align>::inplace_function(const inplace_function& other)
+	{
+		other._vt->copy(_storage, other._storage);
+		_call = other._call;
+		_vt = other._vt;
+	}
+	template<typename R, typename... Args, size_t Capacity, size_t Align>
+	inline inplace_function<R(Args...), Capacity, Align>::inplace_function(inplace_function&& other) noexcept
+		: _call(other._call), _vt(other._vt)
+	{
+		_vt->move(_storage, other._storage);
+		other._call = empty::call;
+		other._vt = &empty::table;
+	}
+	template<typename R, typename... Args, size_t Capacity, size_t Align>
+	inline inplace_function<R(Args...), Capacity, Align>& inplace_function<R(Args...), Capacity, Align>::operator=(const inplace_function& other)
+	{
+		if (this != &other)
+		{
+			*this = nullptr;
+			other._vt->copy(_storage, other._storage);
+			_call = other._call;
+			_vt = other._vt;
+		}
+		return *this;
+	}
+	template<typename R, typename... Args, size_t Capacity, size_t Align>
+	inline inplace_function<R(Args...), Capacity, Align>& inplace_function<R(Args...), Capacity, Align>::operator=(inplace_function&& other) noexcept
+	{
+		if (this != &other)
+		{
+			_vt->destroy(_storage);
+			_call = other._call;
+			_vt = other._vt;
+			_vt->move(_storage, other._storage);
+			other._call = empty::call;
+			other._vt = &empty::table;
+		}
+		return *this;
+	}
+	template<typename R, typename... Args, size_t Capacity, size_t Align>
+	inline inplace_function<R(Args...), Capacity, Align>& inplace_function<R(Args...), Capacity, Align>::operator=(std::nullptr_t) noexcept
+	{
+		_vt->destroy(_storage);
+		_call = empty::call;
+		_vt = &empty::table;
+		return *this;
+	}
+	template<typename R, typename... Args, size_t Capacity, size_t Align>
+	template<typename F, typename>
+	inline inplace_function<R(Args...), Capacity, Align>& inplace_function<R(Args...), Capacity, Align>::operator=(F&& f)
+	{
+		return *this = inplace_function(std::forward<F>(f));
+	}
+	template<typename R, typename... Args, size_t Capacity, size_t Align>
+	inline void inplace_function<R(Args...), Capacity, Align>::swap(inplace_function& other) noexcept
+	{
+		if (this == &other)
+			return;
+		alignas(Align) unsigned char temp[Capacity];
+		_vt->move(temp, _storage);
+		other._vt->move(_storage, other._storage);
+		_vt->move(other._storage, temp);
+		std::swap(_call, other._call);
+		std::swap(_vt, other._vt);
+	}
+
+	template<typename Sig>
+	class unique_function;
+
+	// Owning, move-only callable. Small callables with non-throwing moves are stored inline; larger ones are heap allocated once.
+	template<typename R, typename... Args>
+	class unique_function<R(Args...)>
+	{
+		using empty = __fn::empty<R, Args...>;
+		static constexpr size_t Capacity = 3 * sizeof(void*);
+		static constexpr size_t Align = alignof(void*);
+
+		template<typename F>
+		static constexpr bool stored_locally = sizeof(F) <= Capacity && Align % alignof(F) == 0 && std::is_nothrow_move_constructible_v<F>;
+
+		alignas(Align) mutable unsigned char _storage[Capacity];
+		R(*_call)(void*, Args&&...) = empty::call;
+		const __fn::vtable* _vt = &empty::table;
+
+	public:
+		unique_function() = default;
+		unique_function(std::nullptr_t) {}
+		~unique_function() { _vt->destroy(_storage); }
+		template<typename F, typename = std::enable_if_t<__fn::accepts_v<unique_function, F, R, Args...>>> unique_function(F&& f);
+		unique_function(const unique_function&) = delete;
+		unique_function(unique_function&& other) noexcept;
+		unique_function& operator=(const unique_function&) = delete;
+		unique_function& operator=(unique_function&& other) noexcept;
+		unique_function& operator=(std::nullptr_t) noexcept;
+		template<typename F, typename = std::enable_if_t<__fn::accepts_v<unique_function, F, R, Args...>>> unique_function& operator=(F&& f);
+		R operator()(Args... args) const { return _call(_storage, std::forward<Args>(args)...); }
+		operator bool() const { return _call != empty::call; }
+		void swap(unique_function& other) noexcept;
+	};
+	template<typename R, typename... Args>
+	template<typename F, typename>
+	inline unique_function<R(Args...)>::unique_function(F&& f)
+	{
+		using D = std::decay_t<F>;
+		if (__fn::is_null(f))
+			return;
+		if constexpr (stored_locally<D>)
+		{
+			new (_storage) D(std::forward<F>(f));
+			_call = __fn::local<D, R, Args...>::call;
+			_vt = &__fn::local<D, R, Args...>::movable;
+		}
+		else
+		{
+			new (_storage) D*(new D(std::forward<F>(f)));
+			_call = __fn::remote<D, R, Args...>::call;
+			_vt = &__fn::remote<D, R, Args...>::movable;
+		}
+	}
+	template<typename R, typename... Args>
+	inline unique_function<R(Args...)>::unique_function(unique_function&& other) noexcept
+		: _call(other._call), _vt(other._vt)
+	{
+		_vt->move(_storage, other._storage);
+		other._call = empty::call;
+		other._vt = &empty::table;
+	}
+	template<typename R, typename... Args>
+	inline unique_function<R(Args...)>& unique_function<R(Args...)>::operator=(unique_function&& other) noexcept
+	{
+		if (this != &other)
+		{
+			_vt->destroy(_storage);
+			_call = other._call;
+			_vt = other._vt;
+			_vt->move(_storage, other._storage);
+			other._call = empty::call;
+			other._vt = &empty::table;
+		}
+		return *this;
+	}
+	template<typename R, typename... Args>
+	inline unique_function<R(Args...)>& unique_function<R(Args...)>::operator=(std::nullptr_t) noexcept
+	{
+		_vt->destroy(_storage);
+		_call = empty::call;
+		_vt = &empty::table;
+		return *this;
+	}
+	template<typename R, typename... Args>
+	template<typename F, typename>
+	inline unique_function<R(Args...)>& unique_function<R(Args...)>::operator=(F&& f)
+	{
+		return *this = unique_function(std::forward<F>(f));
+	}
+	template<typename R, typename... Args>
+	inline void unique_function<R(Args...)>::swap(unique_function& other) noexcept
+	{
+		if (this == &other)
+			return;
+		alignas(Align) unsigned char temp[Capacity];
+		_vt->move(temp, _storage);
+		other._vt->move(_storage, other._storage);
+		_vt->move(other._storage, temp);
+		std::swap(_call, other._call);
+		std::swap(_vt, other._vt);
+	}
+}
+
+namespace std
+{
+	template<typename Sig, size_t Capacity, size_t Align>
+	inline void swap(mozaic::inplace_function<Sig, Capacity, Align>& a, mozaic::inplace_function<Sig, Capacity, Align>& b) noexcept
+	{
+		a.swap(b);
+	}
+	template<typename Sig>
+	inline void swap(mozaic::unique_function<Sig>& a, mozaic::unique_function<Sig>& b) noexcept
+	{
+		a.swap(b);
+	}
+}
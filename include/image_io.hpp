@@ -0,0 +1,459 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include "buffers.hpp"
+#include "mapped_file.hpp"
+
+namespace mozaic
+{
+	enum class image_format
+	{
+		raw,
+		pgm,
+		ppm,
+		bmp
+	};
+
+	// Layout of the pixel data in an uncompressed 8-bit image file.
+	struct image_header
+	{
+		image_format format = image_format::raw;
+		size_t width = 0;
+		size_t height = 0;
+		size_t chpp = 0;
+		size_t data_offset = 0;
+		size_t row_padding = 0;
+		bool bottom_up = true;
+		bool bgr = false;
+
+		size_t stride() const { return width * chpp; }
+		size_t file_stride() const { return stride() + row_padding; }
+		size_t file_size() const { return data_offset + file_stride() * height; }
+		// Rows are stored bottom-up with no padding and RGB order, so a mapped view matches buffer2d layout exactly.
+		bool matches_buffer_layout() const { return bottom_up && row_padding == 0 && (!bgr || chpp < 3); }
+
+		static image_header raw(size_t width, size_t height, size_t chpp, size_t data_offset = 0);
+		static image_header make(image_format format, size_t width, size_t height, size_t chpp);
+		static image_header parse(std::istream& in);
+		void write(std::ostream& out) const;
+	};
+
+	struct image_io_error : public std::runtime_error
+	{
+		image_io_error(const std::string& message) : std::runtime_error(message) {}
+	};
+
+	namespace __img
+	{
+		inline uint32_t read_le(const unsigned char* p, size_t n)
+		{
+			uint32_t v = 0;
+			for (size_t i = 0; i < n; ++i)
+				v |= uint32_t(p[i]) << (8 * i);
+			return v;
+		}
+		inline void write_le(std::ostream& out, uint32_t v, size_t n)
+		{
+			for (size_t i = 0; i < n; ++i)
+				out.put(static_cast<char>((v >> (8 * i)) & 0xFF));
+		}
+		inline size_t pnm_read_uint(std::istream& in)
+		{
+			int c = in.get();
+			while (c != EOF)
+			{
+				if (c == '#')
+				{
+					while (c != EOF && c != '\n')
+						c = in.get();
+				}
+				else if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+					break;
+				c = in.get();
+			}
+			if (c < '0' || c > '9')
+				throw image_io_error("malformed PNM header");
+			size_t v = 0;
+			while (c >= '0' && c <= '9')
+			{
+				if (v > (SIZE_MAX - size_t(c - '0')) / 10)
+					throw image_io_error("PNM header value is too large");
+				v = v * 10 + size_t(c - '0');
+				c = in.get();
+			}
+			// exactly one whitespace character separates the header from the data
+			if (c == EOF)
+				throw image_io_error("malformed PNM header");
+			return v;
+		}
+		inline bool mul_overflows(size_t a, size_t b)
+		{
+			return b != 0 && a > SIZE_MAX / b;
+		}
+		// Rejects layouts whose row, pixel data or file size does not fit in size_t, so that stride(), file_size() and the
+		// byte counts derived from them cannot wrap.
+		inline void check_layout(const image_header& h)
+		{
+			if (mul_overflows(h.width, h.chpp) || h.stride() > SIZE_MAX - h.row_padding || mul_overflows(h.file_stride(), h.height)
+				|| h.file_stride() * h.height > SIZE_MAX - h.data_offset)
+				throw image_io_error("image layout " + std::to_string(h.width) + "x" + std::to_string(h.height) + "x" + std::to_string(h.chpp) + " is too large");
+		}
+		inline void swap_red_blue(std::byte* row, size_t width, size_t chpp)
+		{
+			for (size_t x = 0; x < width; ++x)
+				std::swap(row[x * chpp], row[x * chpp + 2]);
+		}
+	}
+
+	inline image_header image_header::raw(size_t width, size_t height, size_t chpp, size_t data_offset)
+	{
+		image_header h;
+		h.width = width;
+		h.height = height;
+		h.chpp = chpp;
+		h.data_offset = data_offset;
+		__img::check_layout(h);
+		return h;
+	}
+	inline image_header image_header::make(image_format format, size_t width, size_t height, size_t chpp)
+	{
+		image_header h = raw(width, height, chpp);
+		h.format = format;
+		switch (format)
+		{
+		case image_format::raw:
+			break;
+		case image_format::pgm:
+		case image_format::ppm:
+		{
+			if (chpp != (format == image_format::pgm ? 1 : 3))
+				throw image_io_error(std::string(format == image_format::pgm ? "PGM" : "PPM") + " cannot store " + std::to_string(chpp) + " channels");
+			std::string header = (format == image_format::pgm ? "P5\n" : "P6\n") + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+			h.data_offset = header.size();
+			h.bottom_up = false;
+			break;
+		}
+		case image_format::bmp:
+			if (chpp != 3 && chpp != 4)
+				throw image_io_error("BMP cannot store " + std::to_string(chpp) + " channels");
+			h.data_offset = 54;
+			h.row_padding = (4 - h.stride() % 4) % 4;
+			h.bgr = true;
+			break;
+		}
+		__img::check_layout(h);
+		return h;
+	}
+	// Detects PGM (P5), PPM (P6) and uncompressed 24/32-bit BMP. Leaves in positioned at the start of the pixel data.
+	inline image_header image_header::parse(std::istream& in)
+	{
+		char magic[2] = {};
+		if (!in.read(magic, 2))
+			throw image_io_error("cannot read image header");
+		if (magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6'))
+		{
+			size_t width = __img::pnm_read_uint(in);
+			size_t height = __img::pnm_read_uint(in);
+			size_t maxval = __img::pnm_read_uint(in);
+			if (maxval == 0 || maxval > 255)
+				throw image_io_error("only 8-bit PNM images are supported (maxval=" + std::to_string(maxval) + ")");
+			image_header h = raw(width, height, magic[1] == '5' ? 1 : 3, static_cast<size_t>(in.tellg()));
+			h.format = magic[1] == '5' ? image_format::pgm : image_format::ppm;
+			h.bottom_up = false;
+			return h;
+		}
+		if (magic[0] == 'B' && magic[1] == 'M')
+		{
+			unsigned char hdr[52];
+			if (!in.read(reinterpret_cast<char*>(hdr), sizeof(hdr)))
+				throw image_io_error("truncated BMP header");
+			size_t data_offset = __img::read_le(hdr + 8, 4);
+			size_t dib_size = __img::read_le(hdr + 12, 4);
+			int32_t width = static_cast<int32_t>(__img::read_le(hdr + 16, 4));
+			int32_t height = static_cast<int32_t>(__img::read_le(hdr + 20, 4));
+			uint32_t bpp = __img::read_le(hdr + 26, 2);
+			uint32_t compression = __img::read_le(hdr + 28, 4);
+			if (dib_size < 40)
+				throw image_io_error("unsupported BMP header version");
+			if (bpp != 24 && bpp != 32)
+				throw image_io_error("only 24-bit and 32-bit BMP images are supported (bpp=" + std::to_string(bpp) + ")");
+			if (compression == 3 && bpp == 32)
+			{
+				// BI_BITFIELDS: the channel masks follow the 40-byte header, or sit inside a V3+ header at the same offset.
+				// Only the BGRA layout that uncompressed 32-bit files use is supported.
+				unsigned char masks[16] = {};
+				if (!in.read(reinterpret_cast<char*>(masks), dib_size >= 56 ? 16 : 12))
+					throw image_io_error("truncated BMP channel masks");
+				uint32_t alpha = __img::read_le(masks + 12, 4);
+				if (__img::read_le(masks, 4) != 0x00FF0000 || __img::read_le(masks + 4, 4) != 0x0000FF00 || __img::read_le(masks + 8, 4) != 0x000000FF
+					|| (alpha != 0 && alpha != 0xFF000000))
+					throw image_io_error("only BGRA channel masks are supported in 32-bit BMP images");
+			}
+			else if (compression != 0)
+				throw image_io_error("compressed BMP images are not supported");
+			if (width <= 0 || height == 0)
+				throw image_io_error("invalid BMP dimensions");
+			image_header h = make(image_format::bmp, size_t(width), size_t(height < 0 ? -int64_t(height) : height), bpp / 8);
+			h.data_offset = data_offset;
+			h.bottom_up = height > 0;
+			__img::check_layout(h);
+			in.seekg(static_cast<std::streamoff>(data_offset));
+			return h;
+		}
+		throw image_io_error("unrecognized image format");
+	}
+	inline void image_header::write(std::ostream& out) const
+	{
+		switch (format)
+		{
+		case image_format::raw:
+			break;
+		case image_format::pgm:
+		case image_format::ppm:
+			out << (format == image_format::pgm ? "P5\n" : "P6\n") << width << " " << height << "\n255\n";
+			break;
+		case image_format::bmp:
+			out.write("BM", 2);
+			__img::write_le(out, uint32_t(file_size()), 4);
+			__img::write_le(out, 0, 4);
+			__img::write_le(out, uint32_t(data_offset), 4);
+			__img::write_le(out, 40, 4);
+			__img::write_le(out, uint32_t(width), 4);
+			__img::write_le(out, bottom_up ? uint32_t(height) : uint32_t(-int32_t(height)), 4);
+			__img::write_le(out, 1, 2);
+			__img::write_le(out, uint32_t(chpp * 8), 2);
+			__img::write_le(out, 0, 4);
+			__img::write_le(out, uint32_t(file_stride() * height), 4);
+			__img::write_le(out, 2835, 4);
+			__img::write_le(out, 2835, 4);
+			__img::write_le(out, 0, 4);
+			__img::write_le(out, 0, 4);
+			break;
+		}
+	}
+
+	// Reads an image in chunks of rows, in buffer2d row order (bottom row first) and RGB channel order.
+	// Memory use is bounded by the caller's chunk, plus one row when the file needs per-row conversion.
+	class image_reader
+	{
+		std::ifstream _in;
+		image_header _header;
+		size_t _row = 0;
+
+	public:
+		explicit image_reader(const std::string& path);
+		image_reader(const std::string& path, const image_header& header);
+
+		const image_header& header() const { return _header; }
+		size_t rows_read() const { return _row; }
+		bool done() const { return _row >= _header.height; }
+		size_t read_rows(std::byte* rows, size_t max_rows);
+		size_t read_rows(buffer2d& chunk);
+		buffer2d read_all();
+	};
+	inline image_reader::image_reader(const std::string& path) : _in(path, std::ios::binary)
+	{
+		if (!_in)
+			throw image_io_error("cannot open \"" + path + "\"");
+		_header = image_header::parse(_in);
+	}
+	inline image_reader::image_reader(const std::string& path, const image_header& header) : _in(path, std::ios::binary), _header(header)
+	{
+		__img::check_layout(_header);
+		if (!_in)
+			throw image_io_error("cannot open \"" + path + "\"");
+	}
+	// Reads up to max_rows rows into rows, which must hold max_rows * header().stride() bytes. Returns the number of rows read.
+	inline size_t image_reader::read_rows(std::byte* rows, size_t max_rows)
+	{
+		size_t n = std::min(max_rows, _header.height - _row);
+		if (n == 0)
+			return 0;
+		size_t stride = _header.stride();
+		size_t fstride = _header.file_stride();
+		// the n rows occupy one contiguous span of the file, stored either in the same or in reverse order
+		size_t first = _header.bottom_up ? _row : _header.height - _row - n;
+		_in.seekg(static_cast<std::streamoff>(_header.data_offset + first * fstride));
+		if (_header.bottom_up && _header.row_padding == 0)
+			_in.read(reinterpret_cast<char*>(rows), static_cast<std::streamsize>(n * stride));
+		else
+		{
+			for (size_t i = 0; i < n; ++i)
+			{
+				std::byte* row = rows + (_header.bottom_up ? i : n - 1 - i) * stride;
+				_in.read(reinterpret_cast<char*>(row), static_cast<std::streamsize>(stride));
+				if (_header.row_padding)
+					_in.seekg(static_cast<std::streamoff>(_header.row_padding), std::ios::cur);
+			}
+		}
+		if (!_in)
+			throw image_io_error("unexpected end of image data at row " + std::to_string(_row));
+		if (_header.bgr && _header.chpp >= 3)
+		{
+			for (size_t i = 0; i < n; ++i)
+				__img::swap_red_blue(rows + i * stride, _header.width, _header.chpp);
+		}
+		_row += n;
+		return n;
+	}
+	inline size_t image_reader::read_rows(buffer2d& chunk)
+	{
+		if (chunk.width() != _header.width || chunk.chpp() != _header.chpp)
+			throw image_io_error("chunk layout does not match image layout");
+		size_t n = read_rows(chunk.buffer(), chunk.height());
+		if (n)
+			chunk.mark_dirty({ 0, chunk.width() - 1, 0, n - 1 });
+		return n;
+	}
+	inline buffer2d image_reader::read_all()
+	{
+		buffer2d buf(_header.width, _header.height - _row, _header.chpp, false);
+		read_rows(buf.buffer(), buf.height());
+		return buf;
+	}
+
+	// Writes an image in chunks of rows, given in buffer2d row order (bottom row first) and RGB channel order.
+	class image_writer
+	{
+		std::ofstream _out;
+		image_header _header;
+		size_t _row = 0;
+		var_array<std::byte> _scratch;
+
+	public:
+		image_writer(const std::string& path, const image_header& header);
+		image_writer(const std::string& path, image_format format, size_t width, size_t height, size_t chpp);
+
+		const image_header& header() const { return _header; }
+		size_t rows_written() const { return _row; }
+		bool done() const { return _row >= _header.height; }
+		void write_rows(const std::byte* rows, size_t count);
+		void write_rows(const buffer2d& chunk, size_t count);
+		void write_rows(const buffer2d& chunk) { write_rows(chunk, chunk.height()); }
+		void close();
+	};
+	inline image_writer::image_writer(const std::string& path, const image_header& header)
+		: _header(header)
+	{
+		__img::check_layout(_header);
+		// write() emits the canonical header of a file format, so the pixel data must go where that header places it, not at
+		// an offset parsed from a file whose header had comments or a larger BMP info header
+		if (_header.format != image_format::raw)
+		{
+			const bool bottom_up = _header.bottom_up;
+			_header = image_header::make(_header.format, _header.width, _header.height, _header.chpp);
+			if (_header.format == image_format::bmp)
+				_header.bottom_up = bottom_up;
+		}
+		_scratch = var_array<std::byte>(_header.file_stride(), false);
+		_out.open(path, std::ios::binary | std::ios::trunc);
+		if (!_out)
+			throw image_io_error("cannot open \"" + path + "\" for writing");
+		_header.write(_out);
+		// reserve the full file so top-down formats can be filled from the bottom row up
+		if (_header.height && _header.file_stride())
+		{
+			_out.seekp(static_cast<std::streamoff>(_header.file_size() - 1));
+			_out.put('\0');
+		}
+		for (size_t i = _header.stride(); i < _header.file_stride(); ++i)
+			_scratch[i] = std::byte(0);
+	}
+	inline image_writer::image_writer(const std::string& path, image_format format, size_t width, size_t height, size_t chpp)
+		: image_writer(path, image_header::make(format, width, height, chpp))
+	{
+	}
+	// Writes count rows from rows, which must hold count * header().stride() bytes.
+	inline void image_writer::write_rows(const std::byte* rows, size_t count)
+	{
+		if (count > _header.height - _row)
+			throw image_io_error("writing " + std::to_string(count) + " rows past the end of a " + std::to_string(_header.height) + "-row image");
+		if (count == 0)
+			return;
+		size_t stride = _header.stride();
+		size_t fstride = _header.file_stride();
+		size_t first = _header.bottom_up ? _row : _header.height - _row - count;
+		_out.seekp(static_cast<std::streamoff>(_header.data_offset + first * fstride));
+		bool convert = _header.row_padding || (_header.bgr && _header.chpp >= 3);
+		if (_header.bottom_up && !convert)
+			_out.write(reinterpret_cast<const char*>(rows), static_cast<std::streamsize>(count * stride));
+		else
+		{
+			for (size_t i = 0; i < count; ++i)
+			{
+				const std::byte* row = rows + (_header.bottom_up ? i : count - 1 - i) * stride;
+				if (convert)
+				{
+					std::memcpy(_scratch.get(), row, stride);
+					if (_header.bgr && _header.chpp >= 3)
+						__img::swap_red_blue(_scratch.get(), _header.width, _header.chpp);
+					_out.write(reinterpret_cast<const char*>(_scratch.get()), static_cast<std::streamsize>(fstride));
+				}
+				else
+					_out.write(reinterpret_cast<const char*>(row), static_cast<std::streamsize>(stride));
+			}
+		}
+		if (!_out)
+			throw image_io_error("failed to write image data at row " + std::to_string(_row));
+		_row += count;
+	}
+	inline void image_writer::write_rows(const buffer2d& chunk, size_t count)
+	{
+		if (chunk.width() != _header.width || chunk.chpp() != _header.chpp)
+			throw image_io_error("chunk layout does not match image layout");
+		write_rows(chunk.buffer(), std::min(count, chunk.height()));
+	}
+	inline void image_writer::close()
+	{
+		_out.close();
+		if (!_out)
+			throw image_io_error("failed to close image file");
+	}
+
+	namespace __img
+	{
+		struct mapped_owner : buffer_owner
+		{
+			mapped_file file;
+
+			explicit mapped_owner(mapped_file&& f) : file(std::move(f)) {}
+			void flush() override { file.flush(); }
+		};
+	}
+
+	// Views the pixels at offset in file in place. Copies of the returned buffer are heap-allocated.
+	inline buffer2d map_buffer(mapped_file&& file, size_t offset, size_t width, size_t height, size_t chpp)
+	{
+		const bool too_large = __img::mul_overflows(width, chpp) || __img::mul_overflows(width * chpp, height);
+		if (too_large || offset > file.size() || file.size() - offset < width * chpp * height)
+			throw std::out_of_range("mapped file is too small for a " + std::to_string(width) + "x" + std::to_string(height) + "x" + std::to_string(chpp) + " buffer at offset " + std::to_string(offset));
+		auto* owner = new __img::mapped_owner(std::move(file));
+		return buffer2d(owner->file.data() + offset, owner, width, height, chpp);
+	}
+
+	// Maps the pixel data of a raw file in place. With write_through, sets and flips are written back to the file.
+	inline buffer2d map_image(const std::string& path, const image_header& header, bool write_through = false)
+	{
+		__img::check_layout(header);
+		if (header.row_padding)
+			throw image_io_error("cannot map an image with padded rows in place");
+		return map_buffer(mapped_file(path, write_through), header.data_offset, header.width, header.height, header.chpp);
+	}
+	// Maps the pixel data of a PGM, PPM or BMP file in place. Pixel bytes are exposed exactly as stored, so check
+	// header.matches_buffer_layout(): PNM rows are stored top-down, and BMP pixels are stored in BGR(A) order.
+	inline buffer2d map_image(const std::string& path, bool write_through = false, image_header* header = nullptr)
+	{
+		std::ifstream in(path, std::ios::binary);
+		if (!in)
+			throw image_io_error("cannot open \"" + path + "\"");
+		image_header h = image_header::parse(in);
+		in.close();
+		if (header)
+			*header = h;
+		return map_image(path, h, write_through);
+	}
+}
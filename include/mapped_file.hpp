@@ -0,0 +1,175 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace mozaic
+{
+	// Memory-mapped view of a whole file. With write_through, writes to the mapping are written back to the file.
+	// Otherwise the mapping is copy-on-write: it can still be modified, but the file is left untouched.
+	class mapped_file
+	{
+		std::byte* _data = nullptr;
+		size_t _size = 0;
+#ifdef _WIN32
+		HANDLE _file = INVALID_HANDLE_VALUE;
+		HANDLE _mapping = nullptr;
+#else
+		int _fd = -1;
+#endif
+
+	public:
+		mapped_file() = default;
+		explicit mapped_file(const std::string& path, bool write_through = false);
+		mapped_file(const mapped_file&) = delete;
+		mapped_file(mapped_file&& other) noexcept;
+		mapped_file& operator=(const mapped_file&) = delete;
+		mapped_file& operator=(mapped_file&& other) noexcept;
+		~mapped_file();
+
+		operator bool() const { return static_cast<bool>(_data); }
+		std::byte* data() { return _data; }
+		const std::byte* data() const { return _data; }
+		size_t size() const { return _size; }
+		void flush();
+		void swap(mapped_file& other) noexcept;
+
+		struct map_error : public std::runtime_error
+		{
+			map_error(const std::string& path, const std::string& what) : std::runtime_error("Cannot map \"" + path + "\": " + what) {}
+		};
+
+	private:
+		void close() noexcept;
+	};
+#ifdef _WIN32
+	inline mapped_file::mapped_file(const std::string& path, bool write_through)
+	{
+		_file = CreateFileA(path.c_str(), write_through ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (_file == INVALID_HANDLE_VALUE)
+			throw map_error(path, "cannot open file");
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(_file, &size))
+		{
+			close();
+			throw map_error(path, "cannot query file size");
+		}
+		_size = static_cast<size_t>(size.QuadPart);
+		if (_size == 0)
+			return;
+		_mapping = CreateFileMappingA(_file, nullptr, write_through ? PAGE_READWRITE : PAGE_WRITECOPY, 0, 0, nullptr);
+		if (!_mapping)
+		{
+			close();
+			throw map_error(path, "cannot create file mapping");
+		}
+		_data = static_cast<std::byte*>(MapViewOfFile(_mapping, write_through ? FILE_MAP_WRITE : FILE_MAP_COPY, 0, 0, 0));
+		if (!_data)
+		{
+			close();
+			throw map_error(path, "cannot map view of file");
+		}
+	}
+	inline void mapped_file::flush()
+	{
+		if (_data)
+			FlushViewOfFile(_data, 0);
+	}
+	inline void mapped_file::close() noexcept
+	{
+		if (_data)
+			UnmapViewOfFile(_data);
+		if (_mapping)
+			CloseHandle(_mapping);
+		if (_file != INVALID_HANDLE_VALUE)
+			CloseHandle(_file);
+		_data = nullptr;
+		_size = 0;
+		_mapping = nullptr;
+		_file = INVALID_HANDLE_VALUE;
+	}
+#else
+	inline mapped_file::mapped_file(const std::string& path, bool write_through)
+	{
+		_fd = ::open(path.c_str(), write_through ? O_RDWR : O_RDONLY);
+		if (_fd < 0)
+			throw map_error(path, "cannot open file");
+		struct stat st;
+		if (::fstat(_fd, &st) != 0)
+		{
+			close();
+			throw map_error(path, "cannot query file size");
+		}
+		_size = static_cast<size_t>(st.st_size);
+		if (_size == 0)
+			return;
+		void* data = ::mmap(nullptr, _size, PROT_READ | PROT_WRITE, write_through ? MAP_SHARED : MAP_PRIVATE, _fd, 0);
+		if (data == MAP_FAILED)
+		{
+			close();
+			throw map_error(path, "mmap failed");
+		}
+		_data = static_cast<std::byte*>(data);
+	}
+	inline void mapped_file::flush()
+	{
+		if (_data)
+			::msync(_data, _size, MS_SYNC);
+	}
+	inline void mapped_file::close() noexcept
+	{
+		if (_data)
+			::munmap(_data, _size);
+		if (_fd >= 0)
+			::close(_fd);
+		_data = nullptr;
+		_size = 0;
+		_fd = -1;
+	}
+#endif
+	inline mapped_file::mapped_file(mapped_file&& other) noexcept
+	{
+		swap(other);
+	}
+	inline mapped_file& mapped_file::operator=(mapped_file&& other) noexcept
+	{
+		if (this != &other)
+		{
+			close();
+			swap(other);
+		}
+		return *this;
+	}
+	inline mapped_file::~mapped_file()
+	{
+		close();
+	}
+	inline void mapped_file::swap(mapped_file& other) noexcept
+	{
+		std::swap(_data, other._data);
+		std::swap(_size, other._size);
+#ifdef _WIN32
+		std::swap(_file, other._file);
+		std::swap(_mapping, other._mapping);
+#else
+		std::swap(_fd, other._fd);
+#endif
+	}
+}
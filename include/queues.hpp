@@ -0,0 +1,506 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+#include "array.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+namespace mozaic
+{
+	// Assumed cache line size. Indices written by different threads are kept this far apart to avoid false sharing.
+	inline constexpr size_t cache_line_size = 64;
+
+	namespace __rb
+	{
+		inline void cpu_relax()
+		{
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+			_mm_pause();
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+			asm volatile("yield");
+#endif
+		}
+
+		inline size_t round_capacity(size_t capacity)
+		{
+			size_t rounded = 2;
+			while (rounded < capacity)
+				rounded <<= 1;
+			return rounded;
+		}
+	}
+
+	// Busy-waits, yielding the thread after a short spin. Lowest latency when producer and consumer have their own cores.
+	struct spin_wait
+	{
+		template<typename Ready> void wait(Ready ready);
+		void notify() {}
+	};
+	template<typename Ready>
+	inline void spin_wait::wait(Ready ready)
+	{
+		for (unsigned spins = 0; !ready(); ++spins)
+		{
+			if (spins < 64)
+				__rb::cpu_relax();
+			else
+				std::this_thread::yield();
+		}
+	}
+
+	// Spins briefly, then sleeps on a condition variable. notify() only takes the lock when a thread is asleep.
+	class blocking_wait
+	{
+		std::mutex _mutex;
+		std::condition_variable _cv;
+		std::atomic<unsigned> _sleepers = 0;
+
+	public:
+		template<typename Ready> void wait(Ready ready);
+		void notify();
+	};
+	template<typename Ready>
+	inline void blocking_wait::wait(Ready ready)
+	{
+		for (unsigned spins = 0; spins < 64; ++spins)
+		{
+			if (ready())
+				return;
+			__rb::cpu_relax();
+		}
+		std::unique_lock<std::mutex> lock(_mutex);
+		_sleepers.fetch_add(1);
+		// pairs with the fence in notify(): either the notifier sees a sleeper, or ready() sees the notifier's update
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		_cv.wait(lock, ready);
+		_sleepers.fetch_sub(1, std::memory_order_relaxed);
+	}
+	inline void blocking_wait::notify()
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (_sleepers.load(std::memory_order_relaxed))
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_cv.notify_all();
+		}
+	}
+
+	// Contiguous run of slots inside a queue's storage, claimed for writing or reading in place. It does not own the
+	// slots and is invalidated once committed.
+	template<typename T>
+	class ring_span
+	{
+		template<typename U, typename W>
+		friend class spsc_ring;
+		template<typename U, typename W>
+		friend class mpmc_queue;
+
+		T* _arr = nullptr;
+		size_t _len = 0;
+		size_t _pos = 0;
+
+		ring_span(T* arr, size_t len, size_t pos) : _arr(arr), _len(len), _pos(pos) {}
+
+	public:
+		ring_span() = default;
+		operator bool() const { return static_cast<bool>(_len); }
+		T* get() { return _arr; }
+		const T* get() const { return _arr; }
+		size_t length() const { return _len; }
+		T& operator[](size_t i);
+		const T& operator[](size_t i) const;
+		T* begin() { return _arr; }
+		T* end() { return _arr + _len; }
+	};
+	template<typename T>
+	inline T& ring_span<T>::operator[](size_t i)
+	{
+		if constexpr (bounds_checked)
+			__arr::check_index(i, _len);
+		return _arr[i];
+	}
+	template<typename T>
+	inline const T& ring_span<T>::operator[](size_t i) const
+	{
+		if constexpr (bounds_checked)
+			__arr::check_index(i, _len);
+		return _arr[i];
+	}
+
+	namespace __rb
+	{
+		// Batch operations shared by both queues, built on claim/commit.
+		template<typename Queue, typename T>
+		inline size_t try_push(Queue& q, const T* items, size_t count)
+		{
+			size_t done = 0;
+			while (done < count)
+			{
+				ring_span<T> span = q.claim_write(count - done);
+				if (!span)
+					break;
+				std::copy(items + done, items + done + span.length(), span.get());
+				q.commit_write(span);
+				done += span.length();
+			}
+			return done;
+		}
+		template<typename Queue, typename T>
+		inline size_t try_pop(Queue& q, T* out, size_t max)
+		{
+			size_t done = 0;
+			while (done < max)
+			{
+				ring_span<T> span = q.claim_read(max - done);
+				if (!span)
+					break;
+				std::move(span.begin(), span.end(), out + done);
+				q.commit_read(span);
+				done += span.length();
+			}
+			return done;
+		}
+	}
+
+	// Lock-free bounded queue for exactly one producer thread and one consumer thread. Capacity is rounded up to a power of two.
+	// Each side caches the other side's index, so the shared cache lines are only read when the cached view runs out.
+	template<typename T, typename Wait = spin_wait>
+	class spsc_ring
+	{
+		var_array<T> _items;
+		size_t _mask;
+
+		alignas(cache_line_size) std::atomic<size_t> _tail = 0;
+		size_t _head_cache = 0;
+		alignas(cache_line_size) std::atomic<size_t> _head = 0;
+		size_t _tail_cache = 0;
+		alignas(cache_line_size) Wait _not_empty;
+		Wait _not_full;
+
+	public:
+		explicit spsc_ring(size_t capacity);
+		spsc_ring(const spsc_ring&) = delete;
+		spsc_ring& operator=(const spsc_ring&) = delete;
+
+		size_t capacity() const { return _mask + 1; }
+		// Exact from the producer or consumer thread, approximate from any other.
+		size_t size() const;
+		bool empty() const { return size() == 0; }
+
+		// Producer side.
+		ring_span<T> claim_write(size_t max);
+		void commit_write(const ring_span<T>& span);
+		bool try_push(const T& item);
+		bool try_push(T&& item);
+		size_t try_push(const T* items, size_t count) { return __rb::try_push(*this, items, count); }
+		size_t try_push(const var_array<T>& batch) { return try_push(batch.get(), batch.length()); }
+		void push(const T& item);
+		void push(const T* items, size_t count);
+
+		// Consumer side.
+		ring_span<T> claim_read(size_t max);
+		void commit_read(const ring_span<T>& span);
+		bool try_pop(T& item);
+		size_t try_pop(T* out, size_t max) { return __rb::try_pop(*this, out, max); }
+		size_t try_pop(var_array<T>& out) { return try_pop(out.get(), out.length()); }
+		T pop();
+		void pop(T* out, size_t count);
+	};
+	template<typename T, typename Wait>
+	inline spsc_ring<T, Wait>::spsc_ring(size_t capacity)
+		: _items(__rb::round_capacity(capacity)), _mask(_items.length() - 1)
+	{
+	}
+	template<typename T, typename Wait>
+	inline size_t spsc_ring<T, Wait>::size() const
+	{
+		// head first: the tail only moves forward and never falls behind the head, so the difference cannot wrap, though
+		// a stale head can make it exceed the capacity
+		const size_t head = _head.load(std::memory_order_acquire);
+		const size_t tail = _tail.load(std::memory_order_acquire);
+		return std::min(tail - head, capacity());
+	}
+	template<typename T, typename Wait>
+	inline ring_span<T> spsc_ring<T, Wait>::claim_write(size_t max)
+	{
+		const size_t tail = _tail.load(std::memory_order_relaxed);
+		size_t free = capacity() - (tail - _head_cache);
+		if (free < max)
+		{
+			_head_cache = _head.load(std::memory_order_acquire);
+			free = capacity() - (tail - _head_cache);
+		}
+		const size_t index = tail & _mask;
+		return ring_span<T>(_items.get() + index, std::min({ max, free, capacity() - index }), tail);
+	}
+	template<typename T, typename Wait>
+	inline void spsc_ring<T, Wait>::commit_write(const ring_span<T>& span)
+	{
+		_tail.store(span._pos + span._len, std::memory_order_release);
+		_not_empty.notify();
+	}
+	template<typename T, typename Wait>
+	inline bool spsc_ring<T, Wait>::try_push(const T& item)
+	{
+		ring_span<T> span = claim_write(1);
+		if (!span)
+			return false;
+		span[0] = item;
+		commit_write(span);
+		return true;
+	}
+	template<typename T, typename Wait>
+	inline bool spsc_ring<T, Wait>::try_push(T&& item)
+	{
+		ring_span<T> span = claim_write(1);
+		if (!span)
+			return false;
+		span[0] = std::move(item);
+		commit_write(span);
+		return true;
+	}
+	template<typename T, typename Wait>
+	inline void spsc_ring<T, Wait>::push(const T& item)
+	{
+		while (!try_push(item))
+			_not_full.wait([this] { return size() < capacity(); });
+	}
+	template<typename T, typename Wait>
+	inline void spsc_ring<T, Wait>::push(const T* items, size_t count)
+	{
+		for (size_t done = try_push(items, count); done < count; done += try_push(items + done, count - done))
+			_not_full.wait([this] { return size() < capacity(); });
+	}
+	template<typename T, typename Wait>
+	inline ring_span<T> spsc_ring<T, Wait>::claim_read(size_t max)
+	{
+		const size_t head = _head.load(std::memory_order_relaxed);
+		size_t available = _tail_cache - head;
+		if (available < max)
+		{
+			_tail_cache = _tail.load(std::memory_order_acquire);
+			available = _tail_cache - head;
+		}
+		const size_t index = head & _mask;
+		return ring_span<T>(_items.get() + index, std::min({ max, available, capacity() - index }), head);
+	}
+	template<typename T, typename Wait>
+	inline void spsc_ring<T, Wait>::commit_read(const ring_span<T>& span)
+	{
+		_head.store(span._pos + span._len, std::memory_order_release);
+		_not_full.notify();
+	}
+	template<typename T, typename Wait>
+	inline bool spsc_ring<T, Wait>::try_pop(T& item)
+	{
+		ring_span<T> span = claim_read(1);
+		if (!span)
+			return false;
+		item = std::move(span[0]);
+		commit_read(span);
+		return true;
+	}
+	template<typename T, typename Wait>
+	inline T spsc_ring<T, Wait>::pop()
+	{
+		T item;
+		while (!try_pop(item))
+			_not_empty.wait([this] { return !empty(); });
+		return item;
+	}
+	template<typename T, typename Wait>
+	inline void spsc_ring<T, Wait>::pop(T* out, size_t count)
+	{
+		for (size_t done = try_pop(out, count); done < count; done += try_pop(out + done, count - done))
+			_not_empty.wait([this] { return !empty(); });
+	}
+
+	// Lock-free bounded queue for any number of producers and consumers, after Vyukov's bounded MPMC queue. Each slot has a
+	// sequence number telling whether it is free or full for the current lap. Sequence numbers live in their own array, so
+	// the items stay contiguous and a claim can cover a run of consecutive slots. A claimed run must be committed promptly:
+	// until then, consumers (or producers, for a read claim) cannot get past it.
+	template<typename T, typename Wait = spin_wait>
+	class mpmc_queue
+	{
+		var_array<T> _items;
+		var_array<std::atomic<size_t>> _seq;
+		size_t _mask;
+
+		alignas(cache_line_size) std::atomic<size_t> _tail = 0;
+		alignas(cache_line_size) std::atomic<size_t> _head = 0;
+		alignas(cache_line_size) Wait _not_empty;
+		Wait _not_full;
+
+	public:
+		explicit mpmc_queue(size_t capacity);
+		mpmc_queue(const mpmc_queue&) = delete;
+		mpmc_queue& operator=(const mpmc_queue&) = delete;
+
+		size_t capacity() const { return _mask + 1; }
+		// Approximate while other threads are active.
+		size_t size() const;
+		bool empty() const { return size() == 0; }
+
+		ring_span<T> claim_write(size_t max);
+		void commit_write(const ring_span<T>& span);
+		bool try_push(const T& item);
+		bool try_push(T&& item);
+		size_t try_push(const T* items, size_t count) { return __rb::try_push(*this, items, count); }
+		size_t try_push(const var_array<T>& batch) { return try_push(batch.get(), batch.length()); }
+		void push(const T& item);
+		void push(const T* items, size_t count);
+
+		ring_span<T> claim_read(size_t max);
+		void commit_read(const ring_span<T>& span);
+		bool try_pop(T& item);
+		size_t try_pop(T* out, size_t max) { return __rb::try_pop(*this, out, max); }
+		size_t try_pop(var_array<T>& out) { return try_pop(out.get(), out.length()); }
+		T pop();
+		void pop(T* out, size_t count);
+	};
+	template<typename T, typename Wait>
+	inline mpmc_queue<T, Wait>::mpmc_queue(size_t capacity)
+		: _items(__rb::round_capacity(capacity)), _seq(_items.length()), _mask(_items.length() - 1)
+	{
+		for (size_t i = 0; i < _seq.length(); ++i)
+			_seq[i].store(i, std::memory_order_relaxed);
+	}
+	template<typename T, typename Wait>
+	inline size_t mpmc_queue<T, Wait>::size() const
+	{
+		const size_t head = _head.load(std::memory_order_acquire);
+		const size_t tail = _tail.load(std::memory_order_acquire);
+		return tail > head ? std::min(tail - head, capacity()) : 0;
+	}
+	template<typename T, typename Wait>
+	inline ring_span<T> mpmc_queue<T, Wait>::claim_write(size_t max)
+	{
+		if (max == 0)
+			return {};
+		size_t pos = _tail.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			const size_t index = pos & _mask;
+			const ptrdiff_t diff = ptrdiff_t(_seq.get()[index].load(std::memory_order_acquire) - pos);
+			if (diff == 0)
+			{
+				// extend the claim over following slots that are also free for this lap, up to the end of storage
+				const size_t limit = std::min(max, capacity() - index);
+				size_t len = 1;
+				while (len < limit && _seq.get()[index + len].load(std::memory_order_acquire) == pos + len)
+					++len;
+				if (_tail.compare_exchange_weak(pos, pos + len, std::memory_order_relaxed))
+					return ring_span<T>(_items.get() + index, len, pos);
+			}
+			else if (diff < 0)
+				return {};
+			else
+				pos = _tail.load(std::memory_order_relaxed);
+		}
+	}
+	template<typename T, typename Wait>
+	inline void mpmc_queue<T, Wait>::commit_write(const ring_span<T>& span)
+	{
+		std::atomic<size_t>* seq = _seq.get() + (span._pos & _mask);
+		for (size_t i = 0; i < span._len; ++i)
+			seq[i].store(span._pos + i + 1, std::memory_order_release);
+		_not_empty.notify();
+	}
+	template<typename T, typename Wait>
+	inline bool mpmc_queue<T, Wait>::try_push(const T& item)
+	{
+		ring_span<T> span = claim_write(1);
+		if (!span)
+			return false;
+		span[0] = item;
+		commit_write(span);
+		return true;
+	}
+	template<typename T, typename Wait>
+	inline bool mpmc_queue<T, Wait>::try_push(T&& item)
+	{
+		ring_span<T> span = claim_write(1);
+		if (!span)
+			return false;
+		span[0] = std::move(item);
+		commit_write(span);
+		return true;
+	}
+	template<typename T, typename Wait>
+	inline void mpmc_queue<T, Wait>::push(const T& item)
+	{
+		while (!try_push(item))
+			_not_full.wait([this] { return size() < capacity(); });
+	}
+	template<typename T, typename Wait>
+	inline void mpmc_queue<T, Wait>::push(const T* items, size_t count)
+	{
+		for (size_t done = try_push(items, count); done < count; done += try_push(items + done, count - done))
+			_not_full.wait([this] { return size() < capacity(); });
+	}
+	template<typename T, typename Wait>
+	inline ring_span<T> mpmc_queue<T, Wait>::claim_read(size_t max)
+	{
+		if (max == 0)
+			return {};
+		size_t pos = _head.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			const size_t index = pos & _mask;
+			const ptrdiff_t diff = ptrdiff_t(_seq.get()[index].load(std::memory_order_acquire) - (pos + 1));
+			if (diff == 0)
+			{
+				const size_t limit = std::min(max, capacity() - index);
+				size_t len = 1;
+				while (len < limit && _seq.get()[index + len].load(std::memory_order_acquire) == pos + len + 1)
+					++len;
+				if (_head.compare_exchange_weak(pos, pos + len, std::memory_order_relaxed))
+					return ring_span<T>(_items.get() + index, len, pos);
+			}
+			else if (diff < 0)
+				return {};
+			else
+				pos = _head.load(std::memory_order_relaxed);
+		}
+	}
+	template<typename T, typename Wait>
+	inline void mpmc_queue<T, Wait>::commit_read(const ring_span<T>& span)
+	{
+		std::atomic<size_t>* seq = _seq.get() + (span._pos & _mask);
+		for (size_t i = 0; i < span._len; ++i)
+			seq[i].store(span._pos + i + capacity(), std::memory_order_release);
+		_not_full.notify();
+	}
+	template<typename T, typename Wait>
+	inline bool mpmc_queue<T, Wait>::try_pop(T& item)
+	{
+		ring_span<T> span = claim_read(1);
+		if (!span)
+			return false;
+		item = std::move(span[0]);
+		commit_read(span);
+		return true;
+	}
+	template<typename T, typename Wait>
+	inline T mpmc_queue<T, Wait>::pop()
+	{
+		T item;
+		while (!try_pop(item))
+			_not_empty.wait([this] { return !empty(); });
+		return item;
+	}
+	template<typename T, typename Wait>
+	inline void mpmc_queue<T, Wait>::pop(T* out, size_t count)
+	{
+		for (size_t done = try_pop(out, count); done < count; done += try_pop(out + done, count - done))
+			_not_empty.wait([this] { return !empty(); });
+	}
+}
@@ -44,7 +44,7 @@ namespace mozaic
 			constexpr Handle& operator=(const Handle&) = default;
 			constexpr Handle& operator=(Handle&&) = default;
 			constexpr operator _Handle() const { return _v; }
-			constexpr bool operator==(const Handle&) const = default;
+			constexpr bool operator==(const Handle& other) const { return _v == other._v; }
 			constexpr Handle operator++(int) { return Handle(_v++); }
 		};
 		struct HandleHash
@@ -108,7 +108,7 @@ namespace mozaic
 		return true;
 	}
 	template<typename _Element, typename _Handle, typename ..._Constructors>
-	inline registry<_Element, _Handle, _Constructors...>::Handle registry<_Element, _Handle, _Constructors...>::add(_Element&& element)
+	inline typename registry<_Element, _Handle, _Constructors...>::Handle registry<_Element, _Handle, _Constructors...>::add(_Element&& element)
 	{
 		if (_current == CAP)
 			throw registry::full_error();
@@ -123,7 +123,7 @@ namespace mozaic
 	}
 	template<typename _Element, typename _Handle, typename ..._Constructors>
 	template<typename _Constructor>
-	inline registry<_Element, _Handle, _Constructors...>::Handle registry<_Element, _Handle, _Constructors...>::construct(const _Constructor& constructor)
+	inline typename registry<_Element, _Handle, _Constructors...>::Handle registry<_Element, _Handle, _Constructors...>::construct(const _Constructor& constructor)
 	{
 		auto& lookup = std::get<std::unordered_map<_Constructor, Handle>>(_lookups);
 		auto iter = lookup.find(constructor);
@@ -144,7 +144,7 @@ namespace mozaic
 	}
 	template<typename _Element, typename _Handle, typename ..._Constructors>
 	template<typename _Constructor>
-	inline registry<_Element, _Handle, _Constructors...>::Handle registry<_Element, _Handle, _Constructors...>::construct(_Constructor&& constructor)
+	inline typename registry<_Element, _Handle, _Constructors...>::Handle registry<_Element, _Handle, _Constructors...>::construct(_Constructor&& constructor)
 	{
 		auto& lookup = std::get<std::unordered_map<_Constructor, Handle>>(_lookups);
 		auto iter = lookup.find(constructor);
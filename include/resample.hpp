@@ -0,0 +1,438 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "buffers.hpp"
+
+#if !defined(MOZAIC_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define MOZAIC_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace mozaic
+{
+	enum class resample_filter
+	{
+		box,
+		bilinear,
+		lanczos
+	};
+
+	// Resizing is separable: a horizontal pass into an 8-bit intermediate, then a vertical pass. Weights are 14-bit fixed point.
+	// With SSE2 the vertical pass is vectorized for any channel count, the horizontal pass for 3 and 4 channels and mipmap
+	// reduction for 1, 3 and 4 channels. Other channel counts use the scalar loops, which give identical results.
+	// threads = 0 uses std::thread::hardware_concurrency().
+	inline buffer2d resize(const buffer2d& src, size_t width, size_t height, resample_filter filter = resample_filter::bilinear, size_t threads = 0);
+	inline void resize(const buffer2d& src, buffer2d& dst, resample_filter filter = resample_filter::bilinear, size_t threads = 0);
+	// Returns levels 1..n of the mipmap chain of src, each a 2x2 box reduction of the previous one, down to 1x1 or max_levels.
+	inline std::vector<buffer2d> mipmap_chain(const buffer2d& src, size_t max_levels = 0, size_t threads = 0);
+
+	namespace __rsm
+	{
+		static constexpr int PRECISION = 14;
+
+		template<typename F>
+		inline void parallel_rows(size_t rows, size_t row_bytes, size_t threads, F&& f)
+		{
+			// not worth a thread for less than about 64KB of output
+			static constexpr size_t MIN_BYTES_PER_THREAD = 1 << 16;
+			if (threads == 0)
+				threads = std::max(1u, std::thread::hardware_concurrency());
+			threads = std::min(threads, std::max<size_t>(1, rows * row_bytes / MIN_BYTES_PER_THREAD));
+			threads = std::min(threads, std::max<size_t>(1, rows));
+			if (threads <= 1)
+			{
+				f(size_t(0), rows);
+				return;
+			}
+			std::vector<std::thread> workers;
+			workers.reserve(threads - 1);
+			size_t per = rows / threads, extra = rows % threads, begin = 0;
+			for (size_t t = 0; t < threads; ++t)
+			{
+				size_t end = begin + per + (t < extra ? 1 : 0);
+				if (t + 1 == threads)
+					f(begin, end);
+				else
+					workers.emplace_back([&f, begin, end]() { f(begin, end); });
+				begin = end;
+			}
+			for (std::thread& worker : workers)
+				worker.join();
+		}
+
+		inline double filter_support(resample_filter filter)
+		{
+			switch (filter)
+			{
+			case resample_filter::box: return 0.5;
+			case resample_filter::bilinear: return 1.0;
+			case resample_filter::lanczos: return 3.0;
+			}
+			return 1.0;
+		}
+		inline double sinc(double x)
+		{
+			if (x == 0.0)
+				return 1.0;
+			x *= 3.14159265358979323846;
+			return std::sin(x) / x;
+		}
+		inline double filter_weight(resample_filter filter, double x)
+		{
+			switch (filter)
+			{
+			case resample_filter::box:
+				return x > -0.5 && x <= 0.5 ? 1.0 : 0.0;
+			case resample_filter::bilinear:
+				x = std::fabs(x);
+				return x < 1.0 ? 1.0 - x : 0.0;
+			case resample_filter::lanczos:
+				return x > -3.0 && x < 3.0 ? sinc(x) * sinc(x / 3.0) : 0.0;
+			}
+			return 0.0;
+		}
+
+		// Every output sample reads taps consecutive input samples from start, which always stay within bounds.
+		struct coefficients
+		{
+			size_t taps = 0;
+			var_array<size_t> start;
+			var_array<int16_t> weights;
+
+			coefficients(size_t in, size_t out, resample_filter filter);
+			const int16_t* weights_of(size_t i) const { return weights.get() + i * taps; }
+		};
+		inline coefficients::coefficients(size_t in, size_t out, resample_filter filter) : start(out), weights()
+		{
+			double scale = double(in) / double(out);
+			double fscale = std::max(scale, 1.0);
+			double support = filter_support(filter) * fscale;
+			taps = std::min(size_t(std::ceil(support)) * 2 + 1, in);
+			weights = var_array<int16_t>(out * taps);
+			std::vector<double> w(taps);
+			for (size_t i = 0; i < out; ++i)
+			{
+				double center = (double(i) + 0.5) * scale;
+				ssize_t lo = std::max<ssize_t>(ssize_t(center - support + 0.5), 0);
+				ssize_t hi = std::min<ssize_t>(ssize_t(center + support + 0.5), ssize_t(in));
+				size_t s = std::min(size_t(lo), in - taps);
+				double total = 0.0;
+				for (size_t k = 0; k < taps; ++k)
+				{
+					ssize_t x = ssize_t(s + k);
+					w[k] = x >= lo && x < hi ? filter_weight(filter, (double(x) - center + 0.5) / fscale) : 0.0;
+					total += w[k];
+				}
+				start[i] = s;
+				int16_t* fixed = weights.get() + i * taps;
+				for (size_t k = 0; k < taps; ++k)
+					fixed[k] = int16_t(std::lround((total != 0.0 ? w[k] / total : 0.0) * (1 << PRECISION)));
+			}
+		}
+
+		inline std::byte clamp_fixed(int32_t acc)
+		{
+			acc >>= PRECISION;
+			return std::byte(acc < 0 ? 0 : acc > 255 ? 255 : acc);
+		}
+
+#ifdef MOZAIC_SSE2
+		inline __m128i weight_pair(int16_t w0, int16_t w1)
+		{
+			return _mm_set1_epi32(int32_t((uint32_t(uint16_t(w1)) << 16) | uint16_t(w0)));
+		}
+		inline __m128i load32(const std::byte* p)
+		{
+			int32_t v;
+			std::memcpy(&v, p, 4);
+			return _mm_cvtsi32_si128(v);
+		}
+		inline __m128i load24(const std::byte* p)
+		{
+			int32_t v = 0;
+			std::memcpy(&v, p, 3);
+			return _mm_cvtsi32_si128(v);
+		}
+		// Rounds and saturates the four 32-bit sums in acc to bytes.
+		inline int32_t pack_fixed(__m128i acc)
+		{
+			acc = _mm_srai_epi32(acc, PRECISION);
+			acc = _mm_packs_epi32(acc, acc);
+			return _mm_cvtsi128_si32(_mm_packus_epi16(acc, acc));
+		}
+#endif
+
+		inline void horizontal_row(const std::byte* in, [[maybe_unused]] size_t in_width, std::byte* out, size_t out_width, size_t chpp, const coefficients& co)
+		{
+			size_t x = 0;
+#ifdef MOZAIC_SSE2
+			if (chpp == 4)
+			{
+				const __m128i zero = _mm_setzero_si128();
+				for (; x < out_width; ++x)
+				{
+					const std::byte* px = in + co.start[x] * 4;
+					const int16_t* w = co.weights_of(x);
+					__m128i acc = _mm_set1_epi32(1 << (PRECISION - 1));
+					size_t k = 0;
+					for (; k + 1 < co.taps; k += 2)
+					{
+						// two neighbouring pixels, interleaved per channel so that madd computes w0 * p0 + w1 * p1
+						__m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(px + k * 4)), zero);
+						p = _mm_unpacklo_epi16(p, _mm_srli_si128(p, 8));
+						acc = _mm_add_epi32(acc, _mm_madd_epi16(p, weight_pair(w[k], w[k + 1])));
+					}
+					if (k < co.taps)
+					{
+						__m128i p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(load32(px + k * 4), zero), zero);
+						acc = _mm_add_epi32(acc, _mm_madd_epi16(p, weight_pair(w[k], 0)));
+					}
+					int32_t v = pack_fixed(acc);
+					std::memcpy(out + x * 4, &v, 4);
+				}
+				return;
+			}
+			if (chpp == 3)
+			{
+				// as above, except that a 64-bit load holds a pair of pixels plus two bytes past it, so pairs that end within
+				// two bytes of the row end are loaded one pixel at a time
+				const __m128i zero = _mm_setzero_si128();
+				const size_t in_bytes = in_width * 3;
+				for (; x < out_width; ++x)
+				{
+					const size_t offset = co.start[x] * 3;
+					const std::byte* px = in + offset;
+					const int16_t* w = co.weights_of(x);
+					__m128i acc = _mm_set1_epi32(1 << (PRECISION - 1));
+					size_t k = 0;
+					for (; k + 1 < co.taps; k += 2)
+					{
+						__m128i p;
+						if (offset + k * 3 + 8 <= in_bytes)
+						{
+							p = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(px + k * 3)), zero);
+							p = _mm_unpacklo_epi16(p, _mm_srli_si128(p, 6));
+						}
+						else
+							p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(load24(px + k * 3), zero), _mm_unpacklo_epi8(load24(px + k * 3 + 3), zero));
+						acc = _mm_add_epi32(acc, _mm_madd_epi16(p, weight_pair(w[k], w[k + 1])));
+					}
+					if (k < co.taps)
+					{
+						__m128i p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(load24(px + k * 3), zero), zero);
+						acc = _mm_add_epi32(acc, _mm_madd_epi16(p, weight_pair(w[k], 0)));
+					}
+					int32_t v = pack_fixed(acc);
+					std::memcpy(out + x * 3, &v, 3);
+				}
+				return;
+			}
+#endif
+			for (; x < out_width; ++x)
+			{
+				const std::byte* px = in + co.start[x] * chpp;
+				const int16_t* w = co.weights_of(x);
+				for (size_t c = 0; c < chpp; ++c)
+				{
+					int32_t acc = 1 << (PRECISION - 1);
+					for (size_t k = 0; k < co.taps; ++k)
+						acc += int32_t(w[k]) * int32_t(px[k * chpp + c]);
+					out[x * chpp + c] = clamp_fixed(acc);
+				}
+			}
+		}
+
+		// Blends co.taps rows of n bytes each, starting at first and stride bytes apart. Channel-agnostic.
+		inline void vertical_row(const std::byte* first, size_t stride, std::byte* out, size_t n, const int16_t* w, size_t taps)
+		{
+			size_t i = 0;
+#ifdef MOZAIC_SSE2
+			const __m128i zero = _mm_setzero_si128();
+			for (; i + 8 <= n; i += 8)
+			{
+				__m128i lo = _mm_set1_epi32(1 << (PRECISION - 1));
+				__m128i hi = lo;
+				size_t k = 0;
+				for (; k + 1 < taps; k += 2)
+				{
+					__m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(first + k * stride + i)), zero);
+					__m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(first + (k + 1) * stride + i)), zero);
+					__m128i wp = weight_pair(w[k], w[k + 1]);
+					lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wp));
+					hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wp));
+				}
+				if (k < taps)
+				{
+					__m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(first + k * stride + i)), zero);
+					__m128i wp = weight_pair(w[k], 0);
+					lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), wp));
+					hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, zero), wp));
+				}
+				__m128i packed = _mm_packs_epi32(_mm_srai_epi32(lo, PRECISION), _mm_srai_epi32(hi, PRECISION));
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(packed, packed));
+			}
+#endif
+			for (; i < n; ++i)
+			{
+				int32_t acc = 1 << (PRECISION - 1);
+				for (size_t k = 0; k < taps; ++k)
+					acc += int32_t(w[k]) * int32_t(first[k * stride + i]);
+				out[i] = clamp_fixed(acc);
+			}
+		}
+
+		// Writes out_width pixels, each the rounded average of a 2x2 block of rows a and b. Columns past in_width - 1 are clamped.
+		inline void downsample_row(const std::byte* a, const std::byte* b, std::byte* out, size_t out_width, size_t in_width, size_t chpp)
+		{
+			size_t x = 0;
+#ifdef MOZAIC_SSE2
+			if (in_width >= 2 * out_width)
+			{
+				const __m128i zero = _mm_setzero_si128();
+				const __m128i two = _mm_set1_epi16(2);
+				if (chpp == 4)
+				{
+					for (; x + 2 <= out_width; x += 2)
+					{
+						__m128i ra = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x * 8));
+						__m128i rb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x * 8));
+						__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(ra, zero), _mm_unpacklo_epi8(rb, zero));
+						__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(ra, zero), _mm_unpackhi_epi8(rb, zero));
+						__m128i sum = _mm_unpacklo_epi64(_mm_add_epi16(lo, _mm_srli_si128(lo, 8)), _mm_add_epi16(hi, _mm_srli_si128(hi, 8)));
+						sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+						_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 4), _mm_packus_epi16(sum, sum));
+					}
+				}
+				else if (chpp == 3)
+				{
+					// 12 bytes of each row make two output pixels; the loads stop at the last input pixel read
+					for (; x + 2 <= out_width; x += 2)
+					{
+						__m128i ra = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(a + x * 6)), load32(a + x * 6 + 8));
+						__m128i rb = _mm_unpacklo_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(b + x * 6)), load32(b + x * 6 + 8));
+						__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(ra, zero), _mm_unpacklo_epi8(rb, zero));
+						__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(ra, zero), _mm_unpackhi_epi8(rb, zero));
+						// channels of input pixels 2 and 3 straddle lo and hi
+						__m128i second = _mm_or_si128(_mm_srli_si128(lo, 12), _mm_slli_si128(hi, 4));
+						__m128i s0 = _mm_add_epi16(lo, _mm_srli_si128(lo, 6));
+						__m128i s1 = _mm_add_epi16(second, _mm_srli_si128(second, 6));
+						__m128i sum = _mm_or_si128(_mm_srli_si128(_mm_slli_si128(s0, 10), 10), _mm_srli_si128(_mm_slli_si128(s1, 10), 4));
+						sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+						std::byte v[8];
+						_mm_storel_epi64(reinterpret_cast<__m128i*>(v), _mm_packus_epi16(sum, sum));
+						std::memcpy(out + x * 3, v, 6);
+					}
+				}
+				else if (chpp == 1)
+				{
+					const __m128i even = _mm_set1_epi16(0x00FF);
+					for (; x + 8 <= out_width; x += 8)
+					{
+						__m128i ra = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x * 2));
+						__m128i rb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x * 2));
+						__m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(ra, even), _mm_srli_epi16(ra, 8)),
+							_mm_add_epi16(_mm_and_si128(rb, even), _mm_srli_epi16(rb, 8)));
+						sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+						_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(sum, sum));
+					}
+				}
+			}
+#endif
+			for (; x < out_width; ++x)
+			{
+				size_t x0 = 2 * x * chpp;
+				size_t x1 = std::min(2 * x + 1, in_width - 1) * chpp;
+				for (size_t c = 0; c < chpp; ++c)
+				{
+					unsigned sum = unsigned(a[x0 + c]) + unsigned(a[x1 + c]) + unsigned(b[x0 + c]) + unsigned(b[x1 + c]);
+					out[x * chpp + c] = std::byte((sum + 2) >> 2);
+				}
+			}
+		}
+
+		inline void downsample_level(const buffer2d& src, buffer2d& dst, size_t row)
+		{
+			const std::byte* a = src.pixel(0, 2 * row);
+			const std::byte* b = src.pixel(0, std::min(2 * row + 1, src.height() - 1));
+			downsample_row(a, b, dst.pixel(0, row), dst.width(), src.width(), src.chpp());
+		}
+	}
+
+	inline void resize(const buffer2d& src, buffer2d& dst, resample_filter filter, size_t threads)
+	{
+		if (src.chpp() != dst.chpp())
+			throw std::invalid_argument("cannot resize between buffers with different channel counts");
+		if (!src.width() || !src.height() || !dst.width() || !dst.height())
+			return;
+		size_t chpp = src.chpp();
+		__rsm::coefficients hco(src.width(), dst.width(), filter);
+		__rsm::coefficients vco(src.height(), dst.height(), filter);
+		// only the input rows that the vertical pass reads need a horizontal pass
+		size_t first_row = vco.start[0];
+		size_t last_row = vco.start[dst.height() - 1] + vco.taps;
+		buffer2d temp(dst.width(), last_row - first_row, chpp, false);
+		__rsm::parallel_rows(temp.height(), temp.stride(), threads, [&](size_t begin, size_t end) {
+			for (size_t y = begin; y < end; ++y)
+				__rsm::horizontal_row(src.pixel(0, first_row + y), src.width(), temp.pixel(0, y), dst.width(), chpp, hco);
+			});
+		__rsm::parallel_rows(dst.height(), dst.stride(), threads, [&](size_t begin, size_t end) {
+			for (size_t y = begin; y < end; ++y)
+				__rsm::vertical_row(temp.pixel(0, vco.start[y] - first_row), temp.stride(), dst.pixel(0, y), dst.stride(), vco.weights_of(y), vco.taps);
+			});
+		dst.mark_dirty({ 0, dst.width() - 1, 0, dst.height() - 1 });
+	}
+	inline buffer2d resize(const buffer2d& src, size_t width, size_t height, resample_filter filter, size_t threads)
+	{
+		buffer2d dst(width, height, src.chpp(), false);
+		resize(src, dst, filter, threads);
+		return dst;
+	}
+
+	inline std::vector<buffer2d> mipmap_chain(const buffer2d& src, size_t max_levels, size_t threads)
+	{
+		std::vector<buffer2d> levels;
+		size_t w = src.width(), h = src.height();
+		while ((w > 1 || h > 1) && (max_levels == 0 || levels.size() < max_levels))
+		{
+			w = std::max<size_t>(1, w / 2);
+			h = std::max<size_t>(1, h / 2);
+			levels.emplace_back(w, h, src.chpp(), false);
+		}
+		if (levels.empty() || !src.width() || !src.height())
+			return levels;
+		auto level_src = [&](size_t l) -> const buffer2d& { return l == 0 ? src : levels[l - 1]; };
+
+		// Level 1 rows are split into bands aligned to BAND_ALIGN rows. As soon as a band completes a pair of rows on one level,
+		// the row they reduce to on the next level is computed while both are still in cache. Levels whose rows no longer
+		// fall within a single band are finished afterwards; they are at most 1/BAND_ALIGN of level 1.
+		static constexpr size_t BAND_LEVELS = 6;
+		static constexpr size_t BAND_ALIGN = size_t(1) << (BAND_LEVELS - 1);
+		size_t in_band = std::min(BAND_LEVELS, levels.size());
+		size_t bands = (levels[0].height() + BAND_ALIGN - 1) / BAND_ALIGN;
+		__rsm::parallel_rows(bands, BAND_ALIGN * levels[0].stride(), threads, [&](size_t begin, size_t end) {
+			for (size_t y1 = begin * BAND_ALIGN; y1 < std::min(end * BAND_ALIGN, levels[0].height()); ++y1)
+			{
+				__rsm::downsample_level(src, levels[0], y1);
+				size_t row = y1;
+				for (size_t l = 1; l < in_band && row % 2 == 1 && levels[l - 1].height() > 1; ++l)
+				{
+					row /= 2;
+					__rsm::downsample_level(levels[l - 1], levels[l], row);
+				}
+			}
+			});
+		for (size_t l = 1; l < levels.size(); ++l)
+		{
+			if (l >= in_band || level_src(l).height() == 1)
+			{
+				for (size_t row = 0; row < levels[l].height(); ++row)
+					__rsm::downsample_level(level_src(l), levels[l], row);
+			}
+		}
+		return levels;
+	}
+}
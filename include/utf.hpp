@@ -1 +1,1321 @@
 #pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "array.hpp"
+
+#if !defined(MOZAIC_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#define MOZAIC_UTF_X86
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define MOZAIC_TARGET_SSE4
+#define MOZAIC_TARGET_AVX2
+#else
+#define MOZAIC_TARGET_SSE4 __attribute__((target("sse4.1")))
+#define MOZAIC_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace mozaic
+{
+	namespace utf
+	{
+		// Instruction sets with dedicated kernels. The best one supported by the CPU is picked on first use.
+		enum class isa
+		{
+			scalar,
+			sse4,
+			avx2
+		};
+
+		isa detected_isa();
+		isa active_isa();
+		// Restricts kernels to the given instruction set, or to the detected one if the CPU does not support it. Returns the active set.
+		isa use_isa(isa set);
+
+		struct encoding_error : public std::runtime_error
+		{
+			size_t position;
+
+			encoding_error(const std::string& encoding, size_t position)
+				: std::runtime_error("invalid " + encoding + " at code unit " + std::to_string(position)), position(position) {}
+		};
+
+		bool validate_utf8(const char* s, size_t len);
+		// Returns the offset of the first invalid sequence, or len if s is valid.
+		size_t find_invalid_utf8(const char* s, size_t len);
+
+		// Length precomputation. Input is assumed valid; transcoding rejects invalid input before writing past these lengths.
+		size_t count_utf8(const char* s, size_t len);
+		size_t utf16_length_from_utf8(const char* s, size_t len);
+		inline size_t utf32_length_from_utf8(const char* s, size_t len) { return count_utf8(s, len); }
+		size_t utf8_length_from_utf16(const char16_t* s, size_t len);
+		size_t utf8_length_from_utf32(const char32_t* s, size_t len);
+
+		// Transcoding into caller-provided buffers, sized with the functions above. Returns the number of code units written,
+		// or throws encoding_error without writing past the valid prefix. The vector kernels transcode runs of code points
+		// below U+0800 (one- and two-byte UTF-8); three- and four-byte sequences and surrogate pairs are transcoded one at a
+		// time, so CJK and emoji text gains only from vectorized validation.
+		size_t utf8_to_utf16(const char* s, size_t len, char16_t* out);
+		size_t utf8_to_utf32(const char* s, size_t len, char32_t* out);
+		size_t utf16_to_utf8(const char16_t* s, size_t len, char* out);
+		size_t utf32_to_utf8(const char32_t* s, size_t len, char* out);
+
+		// Transcoding into exactly sized arrays.
+		var_array<char16_t> utf8_to_utf16(const char* s, size_t len);
+		var_array<char32_t> utf8_to_utf32(const char* s, size_t len);
+		var_array<char> utf16_to_utf8(const char16_t* s, size_t len);
+		var_array<char> utf32_to_utf8(const char32_t* s, size_t len);
+
+		namespace __utf
+		{
+			struct kernels
+			{
+				bool (*validate)(const unsigned char* s, size_t len);
+				size_t (*count_code_points)(const unsigned char* s, size_t len);
+				size_t (*count_four_byte_leads)(const unsigned char* s, size_t len);
+				size_t (*utf8_length_from_utf16)(const char16_t* s, size_t len);
+				size_t (*utf8_length_from_utf32)(const char32_t* s, size_t len);
+				// ASCII kernels convert whole blocks while they are pure ASCII and return the number of code units converted.
+				size_t (*ascii_to_utf16)(const unsigned char* s, size_t len, char16_t* out);
+				size_t (*ascii_to_utf32)(const unsigned char* s, size_t len, char32_t* out);
+				size_t (*ascii_from_utf16)(const char16_t* s, size_t len, unsigned char* out);
+				size_t (*ascii_from_utf32)(const char32_t* s, size_t len, unsigned char* out);
+				// Two-byte kernels convert whole blocks while every code point is below U+0800, i.e. takes one or two UTF-8 bytes.
+				// They return the number of code units read and set written to the number of code units written.
+				size_t (*two_byte_to_utf16)(const unsigned char* s, size_t len, char16_t* out, size_t& written);
+				size_t (*two_byte_to_utf32)(const unsigned char* s, size_t len, char32_t* out, size_t& written);
+				size_t (*two_byte_from_utf16)(const char16_t* s, size_t len, unsigned char* out, size_t& written);
+				size_t (*two_byte_from_utf32)(const char32_t* s, size_t len, unsigned char* out, size_t& written);
+			};
+
+			inline size_t sequence_length(unsigned char lead)
+			{
+				if (lead < 0x80) return 1;
+				if (lead < 0xC2) return 0;
+				if (lead < 0xE0) return 2;
+				if (lead < 0xF0) return 3;
+				if (lead < 0xF5) return 4;
+				return 0;
+			}
+
+			// ------------------------------------------------------------------ scalar
+
+			inline size_t find_invalid_scalar(const unsigned char* s, size_t len)
+			{
+				size_t i = 0;
+				while (i < len)
+				{
+					if (i + 8 <= len)
+					{
+						uint64_t v;
+						std::memcpy(&v, s + i, 8);
+						if (!(v & 0x8080808080808080ull))
+						{
+							i += 8;
+							continue;
+						}
+					}
+					unsigned char c = s[i];
+					size_t n = sequence_length(c);
+					if (n == 1)
+					{
+						++i;
+						continue;
+					}
+					if (n == 0 || i + n > len)
+						return i;
+					for (size_t k = 1; k < n; ++k)
+						if ((s[i + k] & 0xC0) != 0x80)
+							return i;
+					if (n == 3)
+					{
+						uint32_t cp = (uint32_t(c & 0x0F) << 12) | (uint32_t(s[i + 1] & 0x3F) << 6) | uint32_t(s[i + 2] & 0x3F);
+						if (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF))
+							return i;
+					}
+					else if (n == 4)
+					{
+						uint32_t cp = (uint32_t(c & 0x07) << 18) | (uint32_t(s[i + 1] & 0x3F) << 12) | (uint32_t(s[i + 2] & 0x3F) << 6) | uint32_t(s[i + 3] & 0x3F);
+						if (cp < 0x10000 || cp > 0x10FFFF)
+							return i;
+					}
+					i += n;
+				}
+				return len;
+			}
+			inline bool validate_scalar(const unsigned char* s, size_t len)
+			{
+				return find_invalid_scalar(s, len) == len;
+			}
+			inline size_t count_code_points_scalar(const unsigned char* s, size_t len)
+			{
+				size_t count = 0;
+				for (size_t i = 0; i < len; ++i)
+					count += (s[i] & 0xC0) != 0x80;
+				return count;
+			}
+			inline size_t count_four_byte_leads_scalar(const unsigned char* s, size_t len)
+			{
+				size_t count = 0;
+				for (size_t i = 0; i < len; ++i)
+					count += s[i] >= 0xF0;
+				return count;
+			}
+			inline size_t utf8_length_from_utf16_scalar(const char16_t* s, size_t len)
+			{
+				size_t count = 0;
+				for (size_t i = 0; i < len; ++i)
+				{
+					char16_t c = s[i];
+					// a surrogate pair encodes to 4 bytes, 2 for each half
+					count += c < 0x80 ? 1 : c < 0x800 || (c >= 0xD800 && c <= 0xDFFF) ? 2 : 3;
+				}
+				return count;
+			}
+			inline size_t utf8_length_from_utf32_scalar(const char32_t* s, size_t len)
+			{
+				size_t count = 0;
+				for (size_t i = 0; i < len; ++i)
+				{
+					char32_t c = s[i];
+					count += c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+				}
+				return count;
+			}
+			template<typename Char>
+			inline size_t ascii_widen_scalar(const unsigned char* s, size_t len, Char* out)
+			{
+				size_t i = 0;
+				for (; i + 8 <= len; i += 8)
+				{
+					uint64_t v;
+					std::memcpy(&v, s + i, 8);
+					if (v & 0x8080808080808080ull)
+						break;
+					for (size_t k = 0; k < 8; ++k)
+						out[i + k] = Char(s[i + k]);
+				}
+				return i;
+			}
+			template<typename Char>
+			inline size_t ascii_narrow_scalar(const Char* s, size_t len, unsigned char* out)
+			{
+				size_t i = 0;
+				for (; i < len && s[i] < 0x80; ++i)
+					out[i] = static_cast<unsigned char>(s[i]);
+				return i;
+			}
+			// The scalar loops in decode_utf8 and encode_utf8 already handle two-byte sequences one at a time.
+			template<typename In, typename Out>
+			inline size_t two_byte_none(const In*, size_t, Out*, size_t& written)
+			{
+				written = 0;
+				return 0;
+			}
+
+			inline const kernels& scalar_kernels()
+			{
+				static const kernels k{
+					validate_scalar,
+					count_code_points_scalar,
+					count_four_byte_leads_scalar,
+					utf8_length_from_utf16_scalar,
+					utf8_length_from_utf32_scalar,
+					ascii_widen_scalar<char16_t>,
+					ascii_widen_scalar<char32_t>,
+					ascii_narrow_scalar<char16_t>,
+					ascii_narrow_scalar<char32_t>,
+					two_byte_none<unsigned char, char16_t>,
+					two_byte_none<unsigned char, char32_t>,
+					two_byte_none<char16_t, unsigned char>,
+					two_byte_none<char32_t, unsigned char>
+				};
+				return k;
+			}
+
+#ifdef MOZAIC_UTF_X86
+			// Validation follows the lookup algorithm of Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte".
+			// Each error class sets one bit in three 16-entry tables indexed by nibbles of the previous and current byte, so that a
+			// byte pair is invalid iff the three lookups share a bit. 3- and 4-byte sequences are then checked for length separately.
+			enum : uint8_t
+			{
+				TOO_SHORT = 1 << 0,
+				TOO_LONG = 1 << 1,
+				OVERLONG_3 = 1 << 2,
+				TOO_LARGE = 1 << 3,
+				SURROGATE = 1 << 4,
+				OVERLONG_2 = 1 << 5,
+				TOO_LARGE_1000 = 1 << 6,
+				OVERLONG_4 = 1 << 6,
+				TWO_CONTS = 1 << 7,
+				CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS
+			};
+
+#define MOZAIC_UTF_BYTE_1_HIGH \
+			TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+			TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, \
+			TOO_SHORT | OVERLONG_2, \
+			TOO_SHORT, \
+			TOO_SHORT | OVERLONG_3 | SURROGATE, \
+			TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+#define MOZAIC_UTF_BYTE_1_LOW \
+			CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, \
+			CARRY | OVERLONG_2, \
+			CARRY, \
+			CARRY, \
+			CARRY | TOO_LARGE, \
+			CARRY | TOO_LARGE | TOO_LARGE_1000, \
+			CARRY | TOO_LARGE | TOO_LARGE_1000, \
+			CARRY | TOO_LARGE | TOO_LARGE_1000, \
+			CARRY | TOO_LARGE | TOO_LARGE_1000, \
+			CARRY | TOO_LARGE | TOO_LARGE_1000, \
+			CARRY | TOO_LARGE | TOO_LARGE_1000, \
+			CARRY | TOO_LARGE | TOO_LARGE_1000, \
+			CARRY | TOO_LARGE | TOO_LARGE_1000, \
+			CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, \
+			CARRY | TOO_LARGE | TOO_LARGE_1000, \
+			CARRY | TOO_LARGE | TOO_LARGE_1000
+#define MOZAIC_UTF_BYTE_2_HIGH \
+			TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+			TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4, \
+			TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE, \
+			TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+			TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+			TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+
+			// ------------------------------------------------------------------ SSE4.1
+
+			struct sse4_state
+			{
+				__m128i error;
+				__m128i prev_input;
+				__m128i prev_incomplete;
+			};
+
+			MOZAIC_TARGET_SSE4 inline void check_block_sse4(__m128i input, sse4_state& st)
+			{
+				if (_mm_movemask_epi8(input) == 0)
+					st.error = _mm_or_si128(st.error, st.prev_incomplete);
+				else
+				{
+					const __m128i low_nibble = _mm_set1_epi8(0x0F);
+					__m128i prev1 = _mm_alignr_epi8(input, st.prev_input, 15);
+					__m128i byte_1_high = _mm_shuffle_epi8(_mm_setr_epi8(MOZAIC_UTF_BYTE_1_HIGH), _mm_and_si128(_mm_srli_epi16(prev1, 4), low_nibble));
+					__m128i byte_1_low = _mm_shuffle_epi8(_mm_setr_epi8(MOZAIC_UTF_BYTE_1_LOW), _mm_and_si128(prev1, low_nibble));
+					__m128i byte_2_high = _mm_shuffle_epi8(_mm_setr_epi8(MOZAIC_UTF_BYTE_2_HIGH), _mm_and_si128(_mm_srli_epi16(input, 4), low_nibble));
+					__m128i special = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+					__m128i prev2 = _mm_alignr_epi8(input, st.prev_input, 14);
+					__m128i prev3 = _mm_alignr_epi8(input, st.prev_input, 13);
+					// only 111_____ and 1111____ survive the saturating subtractions with their top bit set
+					__m128i must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(char(0xE0 - 0x80))), _mm_subs_epu8(prev3, _mm_set1_epi8(char(0xF0 - 0x80))));
+					__m128i must23_80 = _mm_and_si128(must23, _mm_set1_epi8(char(0x80)));
+					st.error = _mm_or_si128(st.error, _mm_xor_si128(must23_80, special));
+					const __m128i max_value = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, char(0xF0 - 1), char(0xE0 - 1), char(0xC0 - 1));
+					st.prev_incomplete = _mm_subs_epu8(input, max_value);
+				}
+				st.prev_input = input;
+			}
+			MOZAIC_TARGET_SSE4 inline bool validate_sse4(const unsigned char* s, size_t len)
+			{
+				sse4_state st{ _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+				size_t i = 0;
+				for (; i + 16 <= len; i += 16)
+					check_block_sse4(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)), st);
+				if (i < len)
+				{
+					// zero padding is ASCII, so a sequence cut off by the end of input is reported as too short
+					unsigned char tail[16] = {};
+					std::memcpy(tail, s + i, len - i);
+					check_block_sse4(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tail)), st);
+				}
+				st.error = _mm_or_si128(st.error, st.prev_incomplete);
+				return _mm_testz_si128(st.error, st.error);
+			}
+			MOZAIC_TARGET_SSE4 inline size_t sum_bytes_sse4(__m128i counts)
+			{
+				__m128i sums = _mm_sad_epu8(counts, _mm_setzero_si128());
+				return size_t(_mm_cvtsi128_si32(sums)) + size_t(_mm_extract_epi16(sums, 4));
+			}
+			// Counts bytes b with b > threshold as signed bytes, accumulating in 8-bit lanes for at most 255 blocks at a time.
+			MOZAIC_TARGET_SSE4 inline size_t count_greater_sse4(const unsigned char* s, size_t len, char threshold, size_t& consumed)
+			{
+				const __m128i t = _mm_set1_epi8(threshold);
+				size_t count = 0, i = 0;
+				while (i + 16 <= len)
+				{
+					__m128i acc = _mm_setzero_si128();
+					for (size_t blocks = 0; blocks < 255 && i + 16 <= len; ++blocks, i += 16)
+						acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)), t));
+					count += sum_bytes_sse4(acc);
+				}
+				consumed = i;
+				return count;
+			}
+			MOZAIC_TARGET_SSE4 inline size_t count_code_points_sse4(const unsigned char* s, size_t len)
+			{
+				// every byte except a continuation byte (0x80..0xBF, i.e. signed < -64) starts a code point
+				size_t i;
+				size_t count = count_greater_sse4(s, len, char(-65), i);
+				return count + count_code_points_scalar(s + i, len - i);
+			}
+			MOZAIC_TARGET_SSE4 inline size_t count_four_byte_leads_sse4(const unsigned char* s, size_t len)
+			{
+				const __m128i lead = _mm_set1_epi8(char(0xF0));
+				size_t count = 0, i = 0;
+				while (i + 16 <= len)
+				{
+					__m128i acc = _mm_setzero_si128();
+					for (size_t blocks = 0; blocks < 255 && i + 16 <= len; ++blocks, i += 16)
+					{
+						__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+						acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_max_epu8(v, lead), v));
+					}
+					count += sum_bytes_sse4(acc);
+				}
+				return count + count_four_byte_leads_scalar(s + i, len - i);
+			}
+			MOZAIC_TARGET_SSE4 inline size_t utf8_length_from_utf16_sse4(const char16_t* s, size_t len)
+			{
+				const __m128i v80 = _mm_set1_epi16(0x80), v800 = _mm_set1_epi16(0x800), surrogate_mask = _mm_set1_epi16(short(0xF800)), surrogate = _mm_set1_epi16(short(0xD800)), ones = _mm_set1_epi16(1);
+				size_t count = 0, i = 0;
+				while (i + 8 <= len)
+				{
+					__m128i acc = _mm_setzero_si128();
+					for (size_t blocks = 0; blocks < 8192 && i + 8 <= len; ++blocks, i += 8)
+					{
+						__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+						__m128i ge80 = _mm_cmpeq_epi16(_mm_max_epu16(v, v80), v);
+						__m128i ge800 = _mm_cmpeq_epi16(_mm_max_epu16(v, v800), v);
+						__m128i surr = _mm_cmpeq_epi16(_mm_and_si128(v, surrogate_mask), surrogate);
+						__m128i extra = _mm_add_epi16(ge80, _mm_andnot_si128(surr, ge800));
+						acc = _mm_sub_epi32(acc, _mm_madd_epi16(extra, ones));
+					}
+					alignas(16) uint32_t lanes[4];
+					_mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+					count += size_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+				}
+				return count + i + utf8_length_from_utf16_scalar(s + i, len - i);
+			}
+			MOZAIC_TARGET_SSE4 inline size_t utf8_length_from_utf32_sse4(const char32_t* s, size_t len)
+			{
+				const __m128i v7f = _mm_set1_epi32(0x7F), v7ff = _mm_set1_epi32(0x7FF), vffff = _mm_set1_epi32(0xFFFF);
+				size_t count = 0, i = 0;
+				while (i + 4 <= len)
+				{
+					__m128i acc = _mm_setzero_si128();
+					for (size_t blocks = 0; blocks < (1 << 20) && i + 4 <= len; ++blocks, i += 4)
+					{
+						__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+						acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, v7f));
+						acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, v7ff));
+						acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, vffff));
+					}
+					alignas(16) uint32_t lanes[4];
+					_mm_store_si128(reinterpret_cast<__m128i*>(lanes), acc);
+					count += size_t(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+				}
+				return count + i + utf8_length_from_utf32_scalar(s + i, len - i);
+			}
+			MOZAIC_TARGET_SSE4 inline size_t ascii_to_utf16_sse4(const unsigned char* s, size_t len, char16_t* out)
+			{
+				const __m128i zero = _mm_setzero_si128();
+				size_t i = 0;
+				for (; i + 16 <= len; i += 16)
+				{
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+					if (_mm_movemask_epi8(v))
+						break;
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_unpacklo_epi8(v, zero));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 8), _mm_unpackhi_epi8(v, zero));
+				}
+				return i;
+			}
+			MOZAIC_TARGET_SSE4 inline size_t ascii_to_utf32_sse4(const unsigned char* s, size_t len, char32_t* out)
+			{
+				size_t i = 0;
+				for (; i + 16 <= len; i += 16)
+				{
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+					if (_mm_movemask_epi8(v))
+						break;
+					for (int k = 0; k < 4; ++k)
+					{
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + 4 * k), _mm_cvtepu8_epi32(v));
+						v = _mm_srli_si128(v, 4);
+					}
+				}
+				return i;
+			}
+			MOZAIC_TARGET_SSE4 inline size_t ascii_from_utf16_sse4(const char16_t* s, size_t len, unsigned char* out)
+			{
+				const __m128i non_ascii = _mm_set1_epi16(short(0xFF80));
+				size_t i = 0;
+				for (; i + 16 <= len; i += 16)
+				{
+					__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 8));
+					if (!_mm_testz_si128(_mm_or_si128(a, b), non_ascii))
+						break;
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(a, b));
+				}
+				return i + ascii_narrow_scalar(s + i, std::min<size_t>(len - i, 16), out + i);
+			}
+			MOZAIC_TARGET_SSE4 inline size_t ascii_from_utf32_sse4(const char32_t* s, size_t len, unsigned char* out)
+			{
+				const __m128i non_ascii = _mm_set1_epi32(int(0xFFFFFF80));
+				size_t i = 0;
+				for (; i + 16 <= len; i += 16)
+				{
+					__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+					__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 4));
+					__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 8));
+					__m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 12));
+					if (!_mm_testz_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), non_ascii))
+						break;
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(_mm_packus_epi32(a, b), _mm_packus_epi32(c, d)));
+				}
+				return i + ascii_narrow_scalar(s + i, std::min<size_t>(len - i, 16), out + i);
+			}
+
+
+			// pshufb masks that close the gaps left by dropped bytes, indexed by an 8-bit lane mask, with the number of bytes kept.
+			struct compaction_table
+			{
+				unsigned char shuffle[256][16];
+				unsigned char length[256];
+			};
+			// For the 8 16-bit lanes holding a lead byte and a continuation byte each: bit j set means lane j is ASCII and
+			// keeps only its low byte.
+			constexpr compaction_table make_pair_compaction()
+			{
+				compaction_table t{};
+				for (unsigned m = 0; m < 256; ++m)
+				{
+					unsigned char n = 0;
+					for (unsigned j = 0; j < 8; ++j)
+					{
+						t.shuffle[m][n++] = static_cast<unsigned char>(2 * j);
+						if (!(m & (1u << j)))
+							t.shuffle[m][n++] = static_cast<unsigned char>(2 * j + 1);
+					}
+					t.length[m] = n;
+					while (n < 16)
+						t.shuffle[m][n++] = 0x80;
+				}
+				return t;
+			}
+			// For 8 16-bit lanes: bit j set means lane j is kept. length counts lanes, not bytes.
+			constexpr compaction_table make_word_compaction()
+			{
+				compaction_table t{};
+				for (unsigned m = 0; m < 256; ++m)
+				{
+					unsigned char n = 0;
+					for (unsigned j = 0; j < 8; ++j)
+					{
+						if (m & (1u << j))
+						{
+							t.shuffle[m][2 * n] = static_cast<unsigned char>(2 * j);
+							t.shuffle[m][2 * n + 1] = static_cast<unsigned char>(2 * j + 1);
+							++n;
+						}
+					}
+					t.length[m] = n;
+					for (unsigned k = 2 * n; k < 16; ++k)
+						t.shuffle[m][k] = 0x80;
+				}
+				return t;
+			}
+			inline constexpr compaction_table pair_compaction = make_pair_compaction();
+			inline constexpr compaction_table word_compaction = make_word_compaction();
+
+			// Decodes 16 bytes at a time while none of them starts a 3- or 4-byte sequence. Every byte is decoded into a 16-bit
+			// lane as if it started a sequence, then the lanes of continuation bytes are dropped.
+			template<typename Char>
+			MOZAIC_TARGET_SSE4 inline size_t two_byte_to_sse4(const unsigned char* s, size_t len, Char* out, size_t& written)
+			{
+				const __m128i max_byte = _mm_set1_epi8(char(0xDF));
+				const __m128i top_bits = _mm_set1_epi8(char(0xC0));
+				const __m128i continuation = _mm_set1_epi8(char(0x80));
+				const __m128i last_ascii = _mm_set1_epi16(0xBF);
+				const __m128i lead_bits = _mm_set1_epi16(0x1F);
+				const __m128i payload_bits = _mm_set1_epi16(0x3F);
+				size_t i = 0, o = 0;
+				// each store writes 8 code units, which the at least 9 code points in the 40 bytes past the second store cover
+				while (i + 48 <= len)
+				{
+					__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+					if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, max_byte), max_byte)) != 0xFFFF)
+						break;
+					unsigned keep = ~unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(v, top_bits), continuation))) & 0xFFFF;
+					size_t consumed = 16;
+					// a sequence starting in the last byte is left for the next block, which sees its continuation byte
+					if (s[i + 15] >= 0xC0)
+					{
+						keep &= 0x7FFF;
+						consumed = 15;
+					}
+					const __m128i next = _mm_srli_si128(v, 1);
+					for (int half = 0; half < 2; ++half)
+					{
+						__m128i b = _mm_cvtepu8_epi16(half ? _mm_srli_si128(v, 8) : v);
+						__m128i n = _mm_cvtepu8_epi16(half ? _mm_srli_si128(next, 8) : next);
+						__m128i pair = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, lead_bits), 6), _mm_and_si128(n, payload_bits));
+						__m128i cp = _mm_blendv_epi8(b, pair, _mm_cmpgt_epi16(b, last_ascii));
+						unsigned m = (keep >> (8 * half)) & 0xFF;
+						cp = _mm_shuffle_epi8(cp, _mm_loadu_si128(reinterpret_cast<const __m128i*>(word_compaction.shuffle[m])));
+						if constexpr (sizeof(Char) == 2)
+							_mm_storeu_si128(reinterpret_cast<__m128i*>(out + o), cp);
+						else
+						{
+							_mm_storeu_si128(reinterpret_cast<__m128i*>(out + o), _mm_cvtepu16_epi32(cp));
+							_mm_storeu_si128(reinterpret_cast<__m128i*>(out + o + 4), _mm_cvtepu16_epi32(_mm_srli_si128(cp, 8)));
+						}
+						o += word_compaction.length[m];
+					}
+					i += consumed;
+				}
+				written = o;
+				return i;
+			}
+			// Encodes 8 code units at a time while all of them are below U+0800. Every code unit is encoded into a 16-bit lane as
+			// a two-byte sequence, or kept as is if ASCII, then the unused high bytes of the ASCII lanes are dropped.
+			template<typename Char>
+			MOZAIC_TARGET_SSE4 inline size_t two_byte_from_sse4(const Char* s, size_t len, unsigned char* out, size_t& written)
+			{
+				const __m128i ascii_limit = _mm_set1_epi16(0x80);
+				const __m128i lead = _mm_set1_epi16(0xC0);
+				const __m128i payload_bits = _mm_set1_epi16(0x3F);
+				size_t i = 0, o = 0;
+				// each store writes 16 bytes, which the at least 16 code units left produce at least one of each
+				for (; i + 16 <= len; i += 8)
+				{
+					__m128i u;
+					if constexpr (sizeof(Char) == 2)
+					{
+						u = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+						if (!_mm_testz_si128(u, _mm_set1_epi16(short(0xF800))))
+							break;
+					}
+					else
+					{
+						__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+						__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + 4));
+						if (!_mm_testz_si128(_mm_or_si128(a, b), _mm_set1_epi32(int(0xFFFFF800))))
+							break;
+						u = _mm_packus_epi32(a, b);
+					}
+					__m128i ascii = _mm_cmplt_epi16(u, ascii_limit);
+					// lead byte low, continuation byte high, in the order they are stored
+					__m128i pair = _mm_or_si128(_mm_or_si128(_mm_srli_epi16(u, 6), lead), _mm_slli_epi16(_mm_or_si128(_mm_and_si128(u, payload_bits), ascii_limit), 8));
+					pair = _mm_blendv_epi8(pair, u, ascii);
+					unsigned m = unsigned(_mm_movemask_epi8(_mm_packs_epi16(ascii, ascii))) & 0xFF;
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + o), _mm_shuffle_epi8(pair, _mm_loadu_si128(reinterpret_cast<const __m128i*>(pair_compaction.shuffle[m]))));
+					o += pair_compaction.length[m];
+				}
+				written = o;
+				return i;
+			}
+
+			inline const kernels& sse4_kernels()
+			{
+				static const kernels k{
+					validate_sse4,
+					count_code_points_sse4,
+					count_four_byte_leads_sse4,
+					utf8_length_from_utf16_sse4,
+					utf8_length_from_utf32_sse4,
+					ascii_to_utf16_sse4,
+					ascii_to_utf32_sse4,
+					ascii_from_utf16_sse4,
+					ascii_from_utf32_sse4,
+					two_byte_to_sse4<char16_t>,
+					two_byte_to_sse4<char32_t>,
+					two_byte_from_sse4<char16_t>,
+					two_byte_from_sse4<char32_t>
+				};
+				return k;
+			}
+
+			// ------------------------------------------------------------------ AVX2
+
+			struct avx2_state
+			{
+				__m256i error;
+				__m256i prev_input;
+				__m256i prev_incomplete;
+			};
+
+			MOZAIC_TARGET_AVX2 inline __m256i prev_avx2(__m256i input, __m256i prev_input, int n)
+			{
+				// alignr works within 128-bit lanes, so first line up the high lane of prev_input below the low lane of input
+				__m256i shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+				switch (n)
+				{
+				case 1: return _mm256_alignr_epi8(input, shifted, 15);
+				case 2: return _mm256_alignr_epi8(input, shifted, 14);
+				default: return _mm256_alignr_epi8(input, shifted, 13);
+				}
+			}
+			MOZAIC_TARGET_AVX2 inline void check_block_avx2(__m256i input, avx2_state& st)
+			{
+				if (_mm256_movemask_epi8(input) == 0)
+					st.error = _mm256_or_si256(st.error, st.prev_incomplete);
+				else
+				{
+					const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+					__m256i prev1 = prev_avx2(input, st.prev_input, 1);
+					__m256i byte_1_high = _mm256_shuffle_epi8(_mm256_setr_epi8(MOZAIC_UTF_BYTE_1_HIGH, MOZAIC_UTF_BYTE_1_HIGH), _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble));
+					__m256i byte_1_low = _mm256_shuffle_epi8(_mm256_setr_epi8(MOZAIC_UTF_BYTE_1_LOW, MOZAIC_UTF_BYTE_1_LOW), _mm256_and_si256(prev1, low_nibble));
+					__m256i byte_2_high = _mm256_shuffle_epi8(_mm256_setr_epi8(MOZAIC_UTF_BYTE_2_HIGH, MOZAIC_UTF_BYTE_2_HIGH), _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble));
+					__m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+					__m256i prev2 = prev_avx2(input, st.prev_input, 2);
+					__m256i prev3 = prev_avx2(input, st.prev_input, 3);
+					__m256i must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(char(0xE0 - 0x80))), _mm256_subs_epu8(prev3, _mm256_set1_epi8(char(0xF0 - 0x80))));
+					__m256i must23_80 = _mm256_and_si256(must23, _mm256_set1_epi8(char(0x80)));
+					st.error = _mm256_or_si256(st.error, _mm256_xor_si256(must23_80, special));
+					const __m256i max_value = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+						-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, char(0xF0 - 1), char(0xE0 - 1), char(0xC0 - 1));
+					st.prev_incomplete = _mm256_subs_epu8(input, max_value);
+				}
+				st.prev_input = input;
+			}
+			MOZAIC_TARGET_AVX2 inline bool validate_avx2(const unsigned char* s, size_t len)
+			{
+				avx2_state st{ _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+				size_t i = 0;
+				for (; i + 32 <= len; i += 32)
+					check_block_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i)), st);
+				if (i < len)
+				{
+					unsigned char tail[32] = {};
+					std::memcpy(tail, s + i, len - i);
+					check_block_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(tail)), st);
+				}
+				st.error = _mm256_or_si256(st.error, st.prev_incomplete);
+				return _mm256_testz_si256(st.error, st.error);
+			}
+			MOZAIC_TARGET_AVX2 inline size_t sum_bytes_avx2(__m256i counts)
+			{
+				__m256i sums = _mm256_sad_epu8(counts, _mm256_setzero_si256());
+				__m128i halves = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+				return size_t(_mm_cvtsi128_si32(halves)) + size_t(_mm_extract_epi16(halves, 4));
+			}
+			MOZAIC_TARGET_AVX2 inline size_t count_code_points_avx2(const unsigned char* s, size_t len)
+			{
+				const __m256i t = _mm256_set1_epi8(char(-65));
+				size_t count = 0, i = 0;
+				while (i + 32 <= len)
+				{
+					__m256i acc = _mm256_setzero_si256();
+					for (size_t blocks = 0; blocks < 255 && i + 32 <= len; ++blocks, i += 32)
+						acc = _mm256_sub_epi8(acc, _mm256_cmpgt_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i)), t));
+					count += sum_bytes_avx2(acc);
+				}
+				return count + count_code_points_scalar(s + i, len - i);
+			}
+			MOZAIC_TARGET_AVX2 inline size_t count_four_byte_leads_avx2(const unsigned char* s, size_t len)
+			{
+				const __m256i lead = _mm256_set1_epi8(char(0xF0));
+				size_t count = 0, i = 0;
+				while (i + 32 <= len)
+				{
+					__m256i acc = _mm256_setzero_si256();
+					for (size_t blocks = 0; blocks < 255 && i + 32 <= len; ++blocks, i += 32)
+					{
+						__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+						acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(_mm256_max_epu8(v, lead), v));
+					}
+					count += sum_bytes_avx2(acc);
+				}
+				return count + count_four_byte_leads_scalar(s + i, len - i);
+			}
+			MOZAIC_TARGET_AVX2 inline size_t sum_lanes_avx2(__m256i acc)
+			{
+				alignas(32) uint32_t lanes[8];
+				_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+				size_t sum = 0;
+				for (uint32_t lane : lanes)
+					sum += lane;
+				return sum;
+			}
+			MOZAIC_TARGET_AVX2 inline size_t utf8_length_from_utf16_avx2(const char16_t* s, size_t len)
+			{
+				const __m256i v80 = _mm256_set1_epi16(0x80), v800 = _mm256_set1_epi16(0x800), surrogate_mask = _mm256_set1_epi16(short(0xF800)), surrogate = _mm256_set1_epi16(short(0xD800)), ones = _mm256_set1_epi16(1);
+				size_t count = 0, i = 0;
+				while (i + 16 <= len)
+				{
+					__m256i acc = _mm256_setzero_si256();
+					for (size_t blocks = 0; blocks < 8192 && i + 16 <= len; ++blocks, i += 16)
+					{
+						__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+						__m256i ge80 = _mm256_cmpeq_epi16(_mm256_max_epu16(v, v80), v);
+						__m256i ge800 = _mm256_cmpeq_epi16(_mm256_max_epu16(v, v800), v);
+						__m256i surr = _mm256_cmpeq_epi16(_mm256_and_si256(v, surrogate_mask), surrogate);
+						__m256i extra = _mm256_add_epi16(ge80, _mm256_andnot_si256(surr, ge800));
+						acc = _mm256_sub_epi32(acc, _mm256_madd_epi16(extra, ones));
+					}
+					count += sum_lanes_avx2(acc);
+				}
+				return count + i + utf8_length_from_utf16_scalar(s + i, len - i);
+			}
+			MOZAIC_TARGET_AVX2 inline size_t utf8_length_from_utf32_avx2(const char32_t* s, size_t len)
+			{
+				const __m256i v7f = _mm256_set1_epi32(0x7F), v7ff = _mm256_set1_epi32(0x7FF), vffff = _mm256_set1_epi32(0xFFFF);
+				size_t count = 0, i = 0;
+				while (i + 8 <= len)
+				{
+					__m256i acc = _mm256_setzero_si256();
+					for (size_t blocks = 0; blocks < (1 << 20) && i + 8 <= len; ++blocks, i += 8)
+					{
+						__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+						acc = _mm256_sub_epi32(acc, _mm256_cmpgt_epi32(v, v7f));
+						acc = _mm256_sub_epi32(acc, _mm256_cmpgt_epi32(v, v7ff));
+						acc = _mm256_sub_epi32(acc, _mm256_cmpgt_epi32(v, vffff));
+					}
+					count += sum_lanes_avx2(acc);
+				}
+				return count + i + utf8_length_from_utf32_scalar(s + i, len - i);
+			}
+			MOZAIC_TARGET_AVX2 inline size_t ascii_to_utf16_avx2(const unsigned char* s, size_t len, char16_t* out)
+			{
+				size_t i = 0;
+				for (; i + 32 <= len; i += 32)
+				{
+					__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+					if (_mm256_movemask_epi8(v))
+						break;
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+				}
+				return i;
+			}
+			MOZAIC_TARGET_AVX2 inline size_t ascii_to_utf32_avx2(const unsigned char* s, size_t len, char32_t* out)
+			{
+				size_t i = 0;
+				for (; i + 32 <= len; i += 32)
+				{
+					__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+					if (_mm256_movemask_epi8(v))
+						break;
+					for (int k = 0; k < 4; ++k)
+						_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 8 * k), _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(s + i + 8 * k))));
+				}
+				return i;
+			}
+			MOZAIC_TARGET_AVX2 inline size_t ascii_from_utf16_avx2(const char16_t* s, size_t len, unsigned char* out)
+			{
+				const __m256i non_ascii = _mm256_set1_epi16(short(0xFF80));
+				size_t i = 0;
+				for (; i + 32 <= len; i += 32)
+				{
+					__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+					__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + 16));
+					if (!_mm256_testz_si256(_mm256_or_si256(a, b), non_ascii))
+						break;
+					// packus interleaves 128-bit lanes, so restore their order afterwards
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+				}
+				return i + ascii_narrow_scalar(s + i, std::min<size_t>(len - i, 32), out + i);
+			}
+			MOZAIC_TARGET_AVX2 inline size_t ascii_from_utf32_avx2(const char32_t* s, size_t len, unsigned char* out)
+			{
+				const __m256i non_ascii = _mm256_set1_epi32(int(0xFFFFFF80));
+				const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+				size_t i = 0;
+				for (; i + 32 <= len; i += 32)
+				{
+					__m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+					__m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + 8));
+					__m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + 16));
+					__m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + 24));
+					if (!_mm256_testz_si256(_mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d)), non_ascii))
+						break;
+					__m256i packed = _mm256_packus_epi16(_mm256_packus_epi32(a, b), _mm256_packus_epi32(c, d));
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permutevar8x32_epi32(packed, order));
+				}
+				return i + ascii_narrow_scalar(s + i, std::min<size_t>(len - i, 32), out + i);
+			}
+
+			inline const kernels& avx2_kernels()
+			{
+				static const kernels k{
+					validate_avx2,
+					count_code_points_avx2,
+					count_four_byte_leads_avx2,
+					utf8_length_from_utf16_avx2,
+					utf8_length_from_utf32_avx2,
+					ascii_to_utf16_avx2,
+					ascii_to_utf32_avx2,
+					ascii_from_utf16_avx2,
+					ascii_from_utf32_avx2,
+					// pshufb shuffles within 128-bit lanes, so wider compaction would need a cross-lane fixup that costs what it saves
+					two_byte_to_sse4<char16_t>,
+					two_byte_to_sse4<char32_t>,
+					two_byte_from_sse4<char16_t>,
+					two_byte_from_sse4<char32_t>
+				};
+				return k;
+			}
+
+#undef MOZAIC_UTF_BYTE_1_HIGH
+#undef MOZAIC_UTF_BYTE_1_LOW
+#undef MOZAIC_UTF_BYTE_2_HIGH
+#endif
+
+			inline isa detect()
+			{
+#ifdef MOZAIC_UTF_X86
+#if defined(_MSC_VER) && !defined(__clang__)
+				int info[4];
+				__cpuid(info, 0);
+				int max_leaf = info[0];
+				__cpuid(info, 1);
+				bool sse41 = info[2] & (1 << 19);
+				bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+				if (os_avx && max_leaf >= 7)
+				{
+					__cpuidex(info, 7, 0);
+					if (info[1] & (1 << 5))
+						return isa::avx2;
+				}
+				if (sse41)
+					return isa::sse4;
+#else
+				__builtin_cpu_init();
+				if (__builtin_cpu_supports("avx2"))
+					return isa::avx2;
+				if (__builtin_cpu_supports("sse4.1"))
+					return isa::sse4;
+#endif
+#endif
+				return isa::scalar;
+			}
+
+			inline std::atomic<isa>& active()
+			{
+				static std::atomic<isa> set(detect());
+				return set;
+			}
+
+			inline const kernels& get()
+			{
+#ifdef MOZAIC_UTF_X86
+				switch (active().load(std::memory_order_relaxed))
+				{
+				case isa::avx2: return avx2_kernels();
+				case isa::sse4: return sse4_kernels();
+				default: break;
+				}
+#endif
+				return scalar_kernels();
+			}
+
+			inline const unsigned char* bytes(const char* s) { return reinterpret_cast<const unsigned char*>(s); }
+
+			// Decodes one sequence of valid UTF-8 starting at s[i], advancing i.
+			inline uint32_t decode_valid(const unsigned char* s, size_t& i)
+			{
+				unsigned char c = s[i];
+				if (c < 0xE0)
+				{
+					uint32_t cp = (uint32_t(c & 0x1F) << 6) | uint32_t(s[i + 1] & 0x3F);
+					i += 2;
+					return cp;
+				}
+				if (c < 0xF0)
+				{
+					uint32_t cp = (uint32_t(c & 0x0F) << 12) | (uint32_t(s[i + 1] & 0x3F) << 6) | uint32_t(s[i + 2] & 0x3F);
+					i += 3;
+					return cp;
+				}
+				uint32_t cp = (uint32_t(c & 0x07) << 18) | (uint32_t(s[i + 1] & 0x3F) << 12) | (uint32_t(s[i + 2] & 0x3F) << 6) | uint32_t(s[i + 3] & 0x3F);
+				i += 4;
+				return cp;
+			}
+			inline size_t ascii_widen(const kernels& k, const unsigned char* s, size_t len, char16_t* out) { return k.ascii_to_utf16(s, len, out); }
+			inline size_t ascii_widen(const kernels& k, const unsigned char* s, size_t len, char32_t* out) { return k.ascii_to_utf32(s, len, out); }
+			inline size_t ascii_narrow(const kernels& k, const char16_t* s, size_t len, unsigned char* out) { return k.ascii_from_utf16(s, len, out); }
+			inline size_t ascii_narrow(const kernels& k, const char32_t* s, size_t len, unsigned char* out) { return k.ascii_from_utf32(s, len, out); }
+			inline size_t two_byte_widen(const kernels& k, const unsigned char* s, size_t len, char16_t* out, size_t& written) { return k.two_byte_to_utf16(s, len, out, written); }
+			inline size_t two_byte_widen(const kernels& k, const unsigned char* s, size_t len, char32_t* out, size_t& written) { return k.two_byte_to_utf32(s, len, out, written); }
+			inline size_t two_byte_narrow(const kernels& k, const char16_t* s, size_t len, unsigned char* out, size_t& written) { return k.two_byte_from_utf16(s, len, out, written); }
+			inline size_t two_byte_narrow(const kernels& k, const char32_t* s, size_t len, unsigned char* out, size_t& written) { return k.two_byte_from_utf32(s, len, out, written); }
+
+			// Transcodes already validated UTF-8. ASCII runs and runs of one- and two-byte sequences go through the vector kernels,
+			// the rest one sequence at a time.
+			template<typename Char>
+			inline size_t decode_utf8(const kernels& k, const unsigned char* s, size_t len, Char* out)
+			{
+				size_t i = 0, o = 0;
+				while (i < len)
+				{
+					size_t ascii = ascii_widen(k, s + i, len - i, out + o);
+					i += ascii;
+					o += ascii;
+					size_t written;
+					i += two_byte_widen(k, s + i, len - i, out + o, written);
+					o += written;
+					for (size_t stop = std::min(len, i + 32); i < stop;)
+					{
+						if (s[i] < 0x80)
+							out[o++] = Char(s[i++]);
+						else
+						{
+							uint32_t cp = decode_valid(s, i);
+							if constexpr (sizeof(Char) == 2)
+							{
+								if (cp >= 0x10000)
+								{
+									cp -= 0x10000;
+									out[o++] = Char(0xD800 | (cp >> 10));
+									out[o++] = Char(0xDC00 | (cp & 0x3FF));
+									continue;
+								}
+							}
+							out[o++] = Char(cp);
+						}
+					}
+				}
+				return o;
+			}
+
+			inline size_t encode(uint32_t cp, unsigned char* out)
+			{
+				if (cp < 0x80)
+				{
+					out[0] = static_cast<unsigned char>(cp);
+					return 1;
+				}
+				if (cp < 0x800)
+				{
+					out[0] = static_cast<unsigned char>(0xC0 | (cp >> 6));
+					out[1] = static_cast<unsigned char>(0x80 | (cp & 0x3F));
+					return 2;
+				}
+				if (cp < 0x10000)
+				{
+					out[0] = static_cast<unsigned char>(0xE0 | (cp >> 12));
+					out[1] = static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3F));
+					out[2] = static_cast<unsigned char>(0x80 | (cp & 0x3F));
+					return 3;
+				}
+				out[0] = static_cast<unsigned char>(0xF0 | (cp >> 18));
+				out[1] = static_cast<unsigned char>(0x80 | ((cp >> 12) & 0x3F));
+				out[2] = static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3F));
+				out[3] = static_cast<unsigned char>(0x80 | (cp & 0x3F));
+				return 4;
+			}
+
+			template<typename Char>
+			inline size_t encode_utf8(const kernels& k, const Char* s, size_t len, unsigned char* out)
+			{
+				size_t i = 0, o = 0;
+				while (i < len)
+				{
+					size_t ascii = ascii_narrow(k, s + i, len - i, out + o);
+					i += ascii;
+					o += ascii;
+					size_t written;
+					i += two_byte_narrow(k, s + i, len - i, out + o, written);
+					o += written;
+					for (size_t stop = std::min(len, i + 16); i < stop; ++i)
+					{
+						uint32_t cp = uint32_t(s[i]);
+						if constexpr (sizeof(Char) == 2)
+						{
+							if (cp >= 0xD800 && cp <= 0xDFFF)
+							{
+								if (cp > 0xDBFF || i + 1 >= len || s[i + 1] < 0xDC00 || s[i + 1] > 0xDFFF)
+									throw encoding_error("UTF-16", i);
+								cp = 0x10000 + ((cp - 0xD800) << 10) + (uint32_t(s[i + 1]) - 0xDC00);
+								++i;
+							}
+						}
+						else
+						{
+							if (cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+								throw encoding_error("UTF-32", i);
+						}
+						o += encode(cp, out + o);
+					}
+				}
+				return o;
+			}
+
+			inline void require_valid_utf8(const kernels& k, const char* s, size_t len)
+			{
+				if (!k.validate(bytes(s), len))
+					throw encoding_error("UTF-8", find_invalid_scalar(bytes(s), len));
+			}
+
+			// Returns the length of an incomplete sequence at the end of s that may be completed by the next chunk, or 0.
+			inline size_t incomplete_tail(const unsigned char* s, size_t len)
+			{
+				for (size_t k = 1; k <= 3 && k <= len; ++k)
+				{
+					unsigned char c = s[len - k];
+					if ((c & 0xC0) == 0x80)
+						continue;
+					return c >= 0xC0 && sequence_length(c) > k ? k : 0;
+				}
+				return 0;
+			}
+		}
+
+		inline isa detected_isa()
+		{
+			static const isa detected = __utf::detect();
+			return detected;
+		}
+		inline isa active_isa()
+		{
+			return __utf::active().load(std::memory_order_relaxed);
+		}
+		inline isa use_isa(isa set)
+		{
+			if (static_cast<int>(set) > static_cast<int>(detected_isa()))
+				set = detected_isa();
+			__utf::active().store(set, std::memory_order_relaxed);
+			return set;
+		}
+
+		inline bool validate_utf8(const char* s, size_t len)
+		{
+			return __utf::get().validate(__utf::bytes(s), len);
+		}
+		inline size_t find_invalid_utf8(const char* s, size_t len)
+		{
+			if (validate_utf8(s, len))
+				return len;
+			return __utf::find_invalid_scalar(__utf::bytes(s), len);
+		}
+		inline size_t count_utf8(const char* s, size_t len)
+		{
+			return __utf::get().count_code_points(__utf::bytes(s), len);
+		}
+		inline size_t utf16_length_from_utf8(const char* s, size_t len)
+		{
+			const __utf::kernels& k = __utf::get();
+			// code points above U+FFFF, which start with 11110___, take a surrogate pair
+			return k.count_code_points(__utf::bytes(s), len) + k.count_four_byte_leads(__utf::bytes(s), len);
+		}
+		inline size_t utf8_length_from_utf16(const char16_t* s, size_t len)
+		{
+			return __utf::get().utf8_length_from_utf16(s, len);
+		}
+		inline size_t utf8_length_from_utf32(const char32_t* s, size_t len)
+		{
+			return __utf::get().utf8_length_from_utf32(s, len);
+		}
+
+		inline size_t utf8_to_utf16(const char* s, size_t len, char16_t* out)
+		{
+			const __utf::kernels& k = __utf::get();
+			__utf::require_valid_utf8(k, s, len);
+			return __utf::decode_utf8(k, __utf::bytes(s), len, out);
+		}
+		inline size_t utf8_to_utf32(const char* s, size_t len, char32_t* out)
+		{
+			const __utf::kernels& k = __utf::get();
+			__utf::require_valid_utf8(k, s, len);
+			return __utf::decode_utf8(k, __utf::bytes(s), len, out);
+		}
+		inline size_t utf16_to_utf8(const char16_t* s, size_t len, char* out)
+		{
+			return __utf::encode_utf8(__utf::get(), s, len, reinterpret_cast<unsigned char*>(out));
+		}
+		inline size_t utf32_to_utf8(const char32_t* s, size_t len, char* out)
+		{
+			return __utf::encode_utf8(__utf::get(), s, len, reinterpret_cast<unsigned char*>(out));
+		}
+
+		inline var_array<char16_t> utf8_to_utf16(const char* s, size_t len)
+		{
+			const __utf::kernels& k = __utf::get();
+			__utf::require_valid_utf8(k, s, len);
+			var_array<char16_t> out(utf16_length_from_utf8(s, len), false);
+			__utf::decode_utf8(k, __utf::bytes(s), len, out.get());
+			return out;
+		}
+		inline var_array<char32_t> utf8_to_utf32(const char* s, size_t len)
+		{
+			const __utf::kernels& k = __utf::get();
+			__utf::require_valid_utf8(k, s, len);
+			var_array<char32_t> out(count_utf8(s, len), false);
+			__utf::decode_utf8(k, __utf::bytes(s), len, out.get());
+			return out;
+		}
+		inline var_array<char> utf16_to_utf8(const char16_t* s, size_t len)
+		{
+			var_array<char> out(utf8_length_from_utf16(s, len), false);
+			utf16_to_utf8(s, len, out.get());
+			return out;
+		}
+		inline var_array<char> utf32_to_utf8(const char32_t* s, size_t len)
+		{
+			var_array<char> out(utf8_length_from_utf32(s, len), false);
+			utf32_to_utf8(s, len, out.get());
+			return out;
+		}
+
+		// Validates UTF-8 fed in arbitrary chunks. A sequence split across chunks is held back (at most 3 bytes) until it completes.
+		class utf8_validator
+		{
+			unsigned char _pending[4] = {};
+			size_t _npending = 0;
+			bool _valid = true;
+
+		public:
+			bool update(const char* chunk, size_t len);
+			bool finish();
+			bool valid() const { return _valid; }
+			void reset() { _npending = 0; _valid = true; }
+		};
+		inline bool utf8_validator::update(const char* chunk, size_t len)
+		{
+			if (!_valid)
+				return false;
+			const unsigned char* s = __utf::bytes(chunk);
+			if (_npending)
+			{
+				size_t need = __utf::sequence_length(_pending[0]);
+				size_t take = std::min(need - _npending, len);
+				std::memcpy(_pending + _npending, s, take);
+				_npending += take;
+				s += take;
+				len -= take;
+				if (_npending < need)
+					return true;
+				_npending = 0;
+				if (!__utf::validate_scalar(_pending, need))
+					return _valid = false;
+			}
+			size_t tail = __utf::incomplete_tail(s, len);
+			if (!__utf::get().validate(s, len - tail))
+				return _valid = false;
+			std::memcpy(_pending, s + len - tail, tail);
+			_npending = tail;
+			return true;
+		}
+		inline bool utf8_validator::finish()
+		{
+			if (_npending)
+				_valid = false;
+			_npending = 0;
+			return _valid;
+		}
+
+		// Transcodes UTF-8 fed in arbitrary chunks to UTF-16 (Char = char16_t) or UTF-32 (Char = char32_t).
+		// decode() writes at most max_output(len) code units and throws encoding_error with the offset from the start of the stream.
+		template<typename Char>
+		class utf8_decoder
+		{
+			static_assert(sizeof(Char) == 2 || sizeof(Char) == 4, "utf8_decoder decodes to UTF-16 or UTF-32 code units.");
+
+			unsigned char _pending[4] = {};
+			size_t _npending = 0;
+			size_t _position = 0;
+
+		public:
+			size_t max_output(size_t len) const { return len + _npending; }
+			size_t pending() const { return _npending; }
+			size_t decode(const char* chunk, size_t len, Char* out);
+			void finish();
+		};
+		template<typename Char>
+		inline size_t utf8_decoder<Char>::decode(const char* chunk, size_t len, Char* out)
+		{
+			const __utf::kernels& k = __utf::get();
+			const unsigned char* s = __utf::bytes(chunk);
+			size_t o = 0;
+			if (_npending)
+			{
+				size_t need = __utf::sequence_length(_pending[0]);
+				size_t take = std::min(need - _npending, len);
+				std::memcpy(_pending + _npending, s, take);
+				_npending += take;
+				s += take;
+				len -= take;
+				if (_npending < need)
+					return 0;
+				if (!__utf::validate_scalar(_pending, need))
+					throw encoding_error("UTF-8", _position);
+				o = __utf::decode_utf8(k, _pending, need, out);
+				_position += need;
+				_npending = 0;
+			}
+			size_t tail = __utf::incomplete_tail(s, len);
+			size_t body = len - tail;
+			if (!k.validate(s, body))
+				throw encoding_error("UTF-8", _position + __utf::find_invalid_scalar(s, body));
+			o += __utf::decode_utf8(k, s, body, out + o);
+			_position += body;
+			std::memcpy(_pending, s + body, tail);
+			_npending = tail;
+			return o;
+		}
+		template<typename Char>
+		inline void utf8_decoder<Char>::finish()
+		{
+			if (_npending)
+				throw encoding_error("UTF-8", _position);
+		}
+
+		// Transcodes UTF-16 fed in arbitrary chunks to UTF-8, holding back a high surrogate at the end of a chunk.
+		class utf16_encoder
+		{
+			char16_t _high = 0;
+			size_t _position = 0;
+
+		public:
+			size_t max_output(size_t len) const { return 3 * len + (_high ? 1 : 0); }
+			size_t encode(const char16_t* chunk, size_t len, char* out);
+			void finish();
+		};
+		inline size_t utf16_encoder::encode(const char16_t* chunk, size_t len, char* out)
+		{
+			size_t o = 0;
+			if (_high && len)
+			{
+				char16_t pair[2] = { _high, chunk[0] };
+				_high = 0;
+				try
+				{
+					o = utf16_to_utf8(pair, 2, out);
+				}
+				catch (const encoding_error&)
+				{
+					throw encoding_error("UTF-16", _position);
+				}
+				_position += 2;
+				++chunk;
+				--len;
+			}
+			if (len && chunk[len - 1] >= 0xD800 && chunk[len - 1] <= 0xDBFF)
+				_high = chunk[--len];
+			try
+			{
+				o += utf16_to_utf8(chunk, len, out + o);
+			}
+			catch (const encoding_error& e)
+			{
+				throw encoding_error("UTF-16", _position + e.position);
+			}
+			_position += len;
+			return o;
+		}
+		inline void utf16_encoder::finish()
+		{
+			if (_high)
+				throw encoding_error("UTF-16", _position);
+		}
+	}
+}
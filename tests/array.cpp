@@ -0,0 +1,59 @@
+#include "test.hpp"
+
+#include "include/array.hpp"
+
+#include <cstdint>
+#include <string>
+
+using namespace mozaic;
+
+namespace
+{
+	const bool registered = [] {
+		test::add("array/constructors", [] {
+			array<int, 4> a;
+			a[1] = 3;
+			array<int, 4> copy(a);
+			MOZAIC_CHECK(copy[1] == 3 && copy.get() != a.get());
+			array<int, 4> filled(5);
+			MOZAIC_CHECK(filled[0] == 5 && filled[3] == 5);
+			array<std::string, 4> strings(std::string("hi"));
+			MOZAIC_CHECK(strings[0] == "hi" && strings[3] == "hi");
+			array<std::string, 3> built(size_t(2), 'x');
+			MOZAIC_CHECK(built[2] == "xx");
+			array<int, 4> moved(std::move(copy));
+			MOZAIC_CHECK(moved[1] == 3 && !copy);
+			using array4 = array<int, 4>;
+			int* raw = new int[3];
+			MOZAIC_CHECK_THROWS(array4::bad_length_error, array4(raw, 3));
+			delete[] raw;
+			});
+
+		test::add("array/range_checks", [] {
+			array<int, 8> a;
+			int src[4] = { 1, 2, 3, 4 };
+			a.copy(4, src, 4);
+			MOZAIC_CHECK(a[4] == 1 && a[7] == 4);
+			MOZAIC_CHECK_THROWS(out_of_range_error, a.copy(5, src, 4));
+			MOZAIC_CHECK_THROWS(out_of_range_error, a.move(SIZE_MAX, src, 2));
+			MOZAIC_CHECK_THROWS(out_of_range_error, a.subarray<4>(5));
+			MOZAIC_CHECK(a.subarray<4>(4)[3] == 4);
+			MOZAIC_CHECK_THROWS(out_of_range_error, a.at(8));
+			});
+
+		test::add("var_array/range_checks", [] {
+			var_array<int> v(8);
+			int src[2] = { 1, 2 };
+			MOZAIC_CHECK_THROWS(out_of_range_error, v.copy(7, src, 2));
+			MOZAIC_CHECK_THROWS(out_of_range_error, v.subarray(2, SIZE_MAX));
+			MOZAIC_CHECK_THROWS(out_of_range_error, v.subarray(9, 0));
+			MOZAIC_CHECK(v.subarray(2, 6).length() == 6);
+			MOZAIC_CHECK_THROWS(out_of_range_error, v.copy<true>(SIZE_MAX - 1, src, 2));
+			MOZAIC_CHECK_THROWS(out_of_range_error, v.move<true>(SIZE_MAX, src, 2));
+			v.copy<true>(10, src, 2);
+			MOZAIC_CHECK(v.length() == 12 && v[10] == 1 && v[11] == 2);
+			MOZAIC_CHECK_THROWS(out_of_range_error, v.at(12));
+			});
+		return true;
+		}();
+}
@@ -0,0 +1,106 @@
+#include "test.hpp"
+
+#include "include/buffers.hpp"
+
+#include <utility>
+
+using namespace mozaic;
+
+namespace
+{
+	const std::byte white[3] = { std::byte(255), std::byte(255), std::byte(255) };
+
+	size_t set_tiles(const var_array<bool>& tiles)
+	{
+		size_t n = 0;
+		for (size_t i = 0; i < tiles.length(); ++i)
+			n += tiles[i];
+		return n;
+	}
+
+	const bool registered = [] {
+		test::add("buffers/dirty_region_coalescing", [] {
+			dirty_region region(4);
+			region.add({ 0, 3, 0, 3 });
+			region.add({ 1, 2, 1, 2 });
+			MOZAIC_CHECK(region.rects().size() == 1 && region.area() == 16);
+			// touching edges merge into the bounding box
+			region.add({ 4, 7, 0, 3 });
+			MOZAIC_CHECK(region.rects().size() == 1 && (region.rects()[0] == upright_rect{ 0, 7, 0, 3 }));
+			region.add({ 20, 21, 20, 21 });
+			region.add({ 40, 41, 0, 1 });
+			region.add({ 0, 1, 40, 41 });
+			MOZAIC_CHECK(region.rects().size() == 4);
+			// at capacity the new rect merges into whichever rect grows least
+			region.add({ 23, 24, 20, 21 });
+			MOZAIC_CHECK(region.rects().size() == 4);
+			bool merged = false;
+			for (const upright_rect& r : region.rects())
+				merged = merged || r == upright_rect{ 20, 24, 20, 21 };
+			MOZAIC_CHECK(merged);
+			MOZAIC_CHECK((region.bounds() == upright_rect{ 0, 41, 0, 41 }));
+			// rects stay disjoint, so the area is the sum
+			size_t area = 0;
+			for (const upright_rect& r : region.rects())
+				area += r.area();
+			MOZAIC_CHECK(region.area() == area);
+			region.clear();
+			MOZAIC_CHECK(region.empty() && region.area() == 0);
+			});
+
+		test::add("buffers/damaged_tiles", [] {
+			buffer2d buf(100, 50, 3);
+			buf.track_damage(true);
+			buf.set(white, upright_rect{ 5, 20, 5, 5 });
+			buf.set(white, vertical_line{ 99, 40, 200 });
+			var_array<bool> tiles = buf.damaged_tiles(32, 32);
+			// 4 x 2 tiles: the rect falls in column 0 of row 0, the clipped vertical line in column 3 of row 1
+			MOZAIC_CHECK(tiles.length() == 8);
+			MOZAIC_CHECK(tiles[0] && !tiles[1] && !tiles[2] && !tiles[3]);
+			MOZAIC_CHECK(!tiles[4] && !tiles[5] && !tiles[6] && tiles[7]);
+			MOZAIC_CHECK(set_tiles(buf.damaged_tiles(1, 1)) == 16 + 10);
+			buf.clear_damage();
+			MOZAIC_CHECK(set_tiles(buf.damaged_tiles(32, 32)) == 0);
+			buf.mark_dirty({ 0, 99, 0, 49 });
+			MOZAIC_CHECK(set_tiles(buf.damaged_tiles(32, 32)) == 8);
+			buffer2d untracked(10, 10, 3);
+			untracked.set(white, upright_rect{ 0, 9, 0, 9 });
+			MOZAIC_CHECK(untracked.damage().empty());
+			});
+
+		test::add("buffers/damage_follows_pixels", [] {
+			buffer2d tracked(16, 16, 3);
+			tracked.track_damage(true);
+			tracked.set(white, horizontal_line{ 3, 2, 5 });
+			const upright_rect line = { 2, 5, 3, 3 };
+			const upright_rect full = { 0, 15, 0, 15 };
+
+			buffer2d copy(tracked);
+			MOZAIC_CHECK(copy.tracking_damage() && copy.damage().rects().size() == 1 && copy.damage().rects()[0] == line);
+			buffer2d moved(std::move(copy));
+			MOZAIC_CHECK(moved.tracking_damage() && moved.damage().rects().size() == 1 && copy.damage().empty());
+
+			// assignment keeps the destination's setting and dirties everything it overwrote
+			buffer2d untracked(16, 16, 3);
+			tracked = untracked;
+			MOZAIC_CHECK(tracked.tracking_damage() && tracked.damage().rects().size() == 1 && tracked.damage().rects()[0] == full);
+			untracked = moved;
+			MOZAIC_CHECK(!untracked.tracking_damage() && untracked.damage().empty());
+			buffer2d resized(4, 4, 3);
+			resized.track_damage(true);
+			resized = std::move(moved);
+			MOZAIC_CHECK(resized.tracking_damage() && resized.damage().rects().size() == 1 && resized.damage().rects()[0] == full);
+			MOZAIC_CHECK(moved.damage().empty());
+			resized = buffer2d();
+			MOZAIC_CHECK(resized.tracking_damage() && resized.damage().empty());
+
+			buffer2d other(16, 16, 3);
+			buffer2d swapped(16, 16, 3);
+			swapped.track_damage(true);
+			swapped.set(white, horizontal_line{ 3, 2, 5 });
+			std::swap(other, swapped);
+			MOZAIC_CHECK(other.tracking_damage() && !swapped.tracking_damage() && other.damage().rects()[0] == line);
+			});
+		return true;
+		}();
+}
@@ -0,0 +1,101 @@
+#include "test.hpp"
+
+#include "include/functor.hpp"
+
+#include <array>
+#include <functional>
+#include <memory>
+
+using namespace mozaic;
+
+namespace
+{
+	int twice(int v) { return 2 * v; }
+
+	// Counts live instances, so that tests can check every stored callable is destroyed exactly once.
+	struct tracked
+	{
+		static inline int alive = 0;
+		std::array<int, 12> table = {};
+
+		tracked() { ++alive; }
+		tracked(const tracked& other) : table(other.table) { ++alive; }
+		tracked(tracked&& other) noexcept : table(other.table) { ++alive; }
+		~tracked() { --alive; }
+		int operator()(int v) const { return v + table[0]; }
+	};
+
+	struct small_tracked
+	{
+		static inline int alive = 0;
+		int bias = 1;
+
+		small_tracked() { ++alive; }
+		small_tracked(const small_tracked& other) : bias(other.bias) { ++alive; }
+		small_tracked(small_tracked&& other) noexcept : bias(other.bias) { ++alive; }
+		~small_tracked() { --alive; }
+		int operator()(int v) const { return v + bias; }
+	};
+
+	const bool registered = [] {
+		test::add("functor/function_ref", [] {
+			int calls = 0;
+			auto counter = [&calls](int v) { ++calls; return v + 1; };
+			function_ref<int(int)> ref(counter);
+			MOZAIC_CHECK(ref(1) == 2 && ref(2) == 3 && calls == 2);
+			function_ref<int(int)> fn(twice);
+			MOZAIC_CHECK(fn(4) == 8);
+			function_ref<long(int)> converted(&twice);
+			MOZAIC_CHECK(converted(5) == 10);
+			ref = fn;
+			MOZAIC_CHECK(ref(3) == 6);
+			});
+
+		test::add("functor/inplace_function", [] {
+			inplace_function<int(int)> empty;
+			MOZAIC_CHECK(!empty);
+			MOZAIC_CHECK_THROWS(std::bad_function_call, empty(1));
+			{
+				small_tracked callable;
+				inplace_function<int(int)> f(callable);
+				MOZAIC_CHECK(f && f(1) == 2 && small_tracked::alive == 2);
+				inplace_function<int(int)> copy(f);
+				inplace_function<int(int)> moved(std::move(f));
+				MOZAIC_CHECK(copy(2) == 3 && moved(3) == 4);
+				copy = twice;
+				MOZAIC_CHECK(copy(4) == 8);
+				std::swap(copy, moved);
+				MOZAIC_CHECK(copy(3) == 4 && moved(3) == 6);
+				copy = nullptr;
+				MOZAIC_CHECK(!copy);
+				inplace_function<int(int), 64> large(tracked{});
+				MOZAIC_CHECK(large(1) == 1);
+			}
+			MOZAIC_CHECK(small_tracked::alive == 0 && tracked::alive == 0);
+			inplace_function<int(int)> null_pointer(static_cast<int(*)(int)>(nullptr));
+			MOZAIC_CHECK(!null_pointer);
+			});
+
+		test::add("functor/unique_function", [] {
+			unique_function<int(int)> empty;
+			MOZAIC_CHECK_THROWS(std::bad_function_call, empty(1));
+			{
+				// the small callable is stored inline, the 48-byte one on the heap; both must be destroyed once
+				unique_function<int(int)> small{ small_tracked{} };
+				unique_function<int(int)> large{ tracked{} };
+				MOZAIC_CHECK(small(1) == 2 && large(1) == 1 && small_tracked::alive == 1 && tracked::alive == 1);
+				unique_function<int(int)> moved(std::move(large));
+				MOZAIC_CHECK(!large && moved(2) == 2 && tracked::alive == 1);
+				small = std::move(moved);
+				MOZAIC_CHECK(small(3) == 3 && small_tracked::alive == 0 && tracked::alive == 1);
+				auto owned = std::make_unique<int>(7);
+				unique_function<int(int)> move_only([p = std::move(owned)](int v) { return v * *p; });
+				MOZAIC_CHECK(move_only(2) == 14);
+				std::swap(move_only, small);
+				MOZAIC_CHECK(move_only(3) == 3 && small(1) == 7);
+			}
+			MOZAIC_CHECK(small_tracked::alive == 0 && tracked::alive == 0);
+			});
+		return true;
+		}();
+}
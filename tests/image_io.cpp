@@ -0,0 +1,164 @@
+#include "test.hpp"
+
+#include "include/image_io.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+using namespace mozaic;
+
+namespace
+{
+	// Removes the file when the test is done with it, pass or fail.
+	struct temp_file
+	{
+		std::string path;
+
+		explicit temp_file(const std::string& name) : path((std::filesystem::temp_directory_path() / ("mozaic_test_" + name)).string()) {}
+		~temp_file() { std::remove(path.c_str()); }
+	};
+
+	buffer2d random_buffer(size_t width, size_t height, size_t chpp, unsigned long long seed)
+	{
+		buffer2d buf(width, height, chpp, false);
+		test::xorshift rng{ seed };
+		for (size_t i = 0; i < buf.bytes(); ++i)
+			buf.buffer()[i] = std::byte(rng());
+		return buf;
+	}
+
+	bool equal(const buffer2d& a, const buffer2d& b)
+	{
+		return a.width() == b.width() && a.height() == b.height() && a.chpp() == b.chpp() && std::memcmp(a.buffer(), b.buffer(), a.bytes()) == 0;
+	}
+
+	// Writes buf in two chunks of rows, so that chunked writes of top-down formats are covered too.
+	void write(const std::string& path, const image_header& header, const buffer2d& buf)
+	{
+		image_writer writer(path, header);
+		const size_t first = buf.height() / 2;
+		writer.write_rows(buf.buffer(), first);
+		writer.write_rows(buf.pixel(0, first), buf.height() - first);
+		MOZAIC_CHECK(writer.done());
+		writer.close();
+	}
+
+	void round_trip(const std::string& name, image_header header, unsigned long long seed)
+	{
+		temp_file file(name);
+		buffer2d buf = random_buffer(header.width, header.height, header.chpp, seed);
+		write(file.path, header, buf);
+		std::ifstream in(file.path, std::ios::binary | std::ios::ate);
+		MOZAIC_CHECK(size_t(in.tellg()) == header.file_size());
+		image_reader reader(file.path);
+		MOZAIC_CHECK(reader.header().format == header.format && reader.header().width == header.width && reader.header().height == header.height);
+		MOZAIC_CHECK(reader.header().bottom_up == header.bottom_up && reader.header().data_offset == header.data_offset);
+		MOZAIC_CHECK(equal(reader.read_all(), buf));
+		// chunked reads of a few rows at a time
+		image_reader chunked(file.path);
+		buffer2d chunk(header.width, 3, header.chpp);
+		bool same = true;
+		for (size_t row = 0; !chunked.done();)
+		{
+			size_t n = chunked.read_rows(chunk);
+			same = same && std::memcmp(chunk.buffer(), buf.pixel(0, row), n * buf.stride()) == 0;
+			row += n;
+		}
+		MOZAIC_CHECK(same);
+	}
+
+	const bool registered = [] {
+		test::add("image_io/round_trips", [] {
+			round_trip("gray.pgm", image_header::make(image_format::pgm, 13, 7, 1), 1);
+			round_trip("color.ppm", image_header::make(image_format::ppm, 13, 7, 3), 2);
+			// 5 * 3 bytes per row needs a byte of padding
+			round_trip("rgb.bmp", image_header::make(image_format::bmp, 5, 9, 3), 3);
+			round_trip("rgba.bmp", image_header::make(image_format::bmp, 6, 4, 4), 4);
+			image_header top_down = image_header::make(image_format::bmp, 7, 5, 3);
+			top_down.bottom_up = false;
+			round_trip("top_down.bmp", top_down, 5);
+			MOZAIC_CHECK_THROWS(image_io_error, image_header::make(image_format::ppm, 4, 4, 4));
+			});
+
+		test::add("image_io/map_image", [] {
+			temp_file file("mapped.ppm");
+			buffer2d buf = random_buffer(9, 6, 3, 6);
+			write(file.path, image_header::make(image_format::ppm, 9, 6, 3), buf);
+			image_header header;
+			{
+				buffer2d mapped = map_image(file.path, false, &header);
+				MOZAIC_CHECK(mapped.mapped() && !header.matches_buffer_layout());
+				// PNM rows are top-down, so the mapped view is upside down
+				bool flipped = true;
+				for (size_t y = 0; y < 6; ++y)
+					flipped = flipped && std::memcmp(mapped.pixel(0, y), buf.pixel(0, 5 - y), buf.stride()) == 0;
+				MOZAIC_CHECK(flipped);
+				buffer2d copy(mapped);
+				MOZAIC_CHECK(!copy.mapped() && equal(copy, mapped));
+				// copy-on-write: changes stay out of the file
+				mapped.buffer()[0] = ~mapped.buffer()[0];
+			}
+			MOZAIC_CHECK(equal(image_reader(file.path).read_all(), buf));
+			{
+				buffer2d mapped = map_image(file.path, true);
+				mapped.flip_vertically();
+				mapped.flush();
+			}
+			// written through: flipping the top-down rows makes the file's row order match the buffer
+			std::ifstream in(file.path, std::ios::binary);
+			std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			MOZAIC_CHECK(bytes.size() == header.file_size() && std::memcmp(bytes.data() + header.data_offset, buf.buffer(), buf.bytes()) == 0);
+
+			MOZAIC_CHECK_THROWS(image_io_error, map_image(file.path, image_header::make(image_format::bmp, 5, 9, 3)));
+			MOZAIC_CHECK_THROWS(std::out_of_range, map_image(file.path, image_header::raw(100, 100, 3)));
+			});
+
+		test::add("image_io/bmp_bitfields", [] {
+			// 2x1 32-bit BI_BITFIELDS file with a 40-byte header followed by the three channel masks
+			auto make = [](uint32_t red, uint32_t green, uint32_t blue) {
+				std::string s = "BM";
+				auto le = [&s](uint32_t v, int n) { for (int i = 0; i < n; ++i) s += char((v >> (8 * i)) & 0xFF); };
+				le(14 + 40 + 12 + 8, 4); le(0, 4); le(14 + 40 + 12, 4);
+				le(40, 4); le(2, 4); le(1, 4); le(1, 2); le(32, 2); le(3, 4); le(8, 4); le(2835, 4); le(2835, 4); le(0, 4); le(0, 4);
+				le(red, 4); le(green, 4); le(blue, 4);
+				le(0xFF332211, 4); le(0xFF665544, 4);
+				return s;
+			};
+			temp_file file("bitfields.bmp");
+			std::ofstream(file.path, std::ios::binary) << make(0x00FF0000, 0x0000FF00, 0x000000FF);
+			buffer2d pixels = image_reader(file.path).read_all();
+			MOZAIC_CHECK(pixels.chpp() == 4 && pixels.buffer()[0] == std::byte(0x33) && pixels.buffer()[2] == std::byte(0x11));
+			std::ofstream(file.path, std::ios::binary) << make(0x000000FF, 0x0000FF00, 0x00FF0000);
+			MOZAIC_CHECK_THROWS(image_io_error, image_reader(file.path));
+			});
+
+		test::add("image_io/overflow", [] {
+			// width * 3 wraps to 2, which the two bytes of pixel data would satisfy
+			temp_file file("overflow.ppm");
+			std::ofstream(file.path, std::ios::binary) << "P6\n6148914691236517206 1\n255\n\1\2";
+			MOZAIC_CHECK_THROWS(image_io_error, image_reader(file.path));
+			MOZAIC_CHECK_THROWS(image_io_error, map_image(file.path));
+			std::ofstream(file.path, std::ios::binary) << "P6\n99999999999999999999999 1\n255\n";
+			MOZAIC_CHECK_THROWS(image_io_error, image_reader(file.path));
+			MOZAIC_CHECK_THROWS(image_io_error, image_header::raw(SIZE_MAX / 2, 3, 1));
+			MOZAIC_CHECK_THROWS(image_io_error, image_header::raw(1, 1, 1, SIZE_MAX));
+			MOZAIC_CHECK_THROWS(std::out_of_range, map_buffer(mapped_file(file.path), 0, 6148914691236517206, 1, 3));
+			});
+
+		test::add("image_io/rewrites_parsed_header", [] {
+			// a comment moves the pixel data past where a canonical header would put it
+			temp_file source("commented.ppm"), copy("rewritten.ppm");
+			std::ofstream(source.path, std::ios::binary) << "P6\n# made by hand\n2 1\n255\n" << "abcdef";
+			image_reader reader(source.path);
+			MOZAIC_CHECK(reader.header().data_offset == 26);
+			buffer2d pixels = reader.read_all();
+			write(copy.path, reader.header(), pixels);
+			image_reader rewritten(copy.path);
+			MOZAIC_CHECK(rewritten.header().data_offset == 11 && equal(rewritten.read_all(), pixels));
+			});
+		return true;
+		}();
+}
@@ -0,0 +1,59 @@
+#include "test.hpp"
+
+#include <cstring>
+#include <exception>
+#include <iostream>
+
+// Usage: mozaic_tests [--filter <substring>] [--list]
+// Runs every registered test in registration order and exits non-zero if any fail.
+
+int main(int argc, char** argv)
+{
+	std::string filter;
+	bool list = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+			filter = argv[++i];
+		else if (std::strcmp(argv[i], "--list") == 0)
+			list = true;
+		else
+		{
+			std::cerr << "usage: " << argv[0] << " [--filter <substring>] [--list]" << std::endl;
+			return 2;
+		}
+	}
+
+	size_t run = 0, failed = 0;
+	for (const mozaic::test::test_case& t : mozaic::test::tests())
+	{
+		if (!filter.empty() && t.name.find(filter) == std::string::npos)
+			continue;
+		if (list)
+		{
+			std::cout << t.name << std::endl;
+			continue;
+		}
+		++run;
+		try
+		{
+			t.body();
+		}
+		catch (const std::exception& e)
+		{
+			++failed;
+			std::cerr << "FAIL " << t.name << "\n  " << e.what() << std::endl;
+			continue;
+		}
+		catch (...)
+		{
+			++failed;
+			std::cerr << "FAIL " << t.name << "\n  unknown exception" << std::endl;
+			continue;
+		}
+		std::cout << "ok   " << t.name << std::endl;
+	}
+	if (!list)
+		std::cout << run - failed << "/" << run << " tests passed" << std::endl;
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,131 @@
+#include "test.hpp"
+
+#include "include/queues.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace mozaic;
+
+namespace
+{
+	constexpr size_t messages = 200000;
+
+	// Producers push their share of 0..count-1, singly or in batches of odd sizes; consumers pop in batches until every
+	// item has been seen. Checks that the count and sum match, so no item is lost or duplicated.
+	template<typename Queue>
+	void stress(size_t producers, size_t consumers, size_t count, bool batched)
+	{
+		Queue queue(64);
+		std::atomic<size_t> popped = 0;
+		std::atomic<unsigned long long> sum = 0;
+		std::vector<std::thread> threads;
+		for (size_t p = 0; p < producers; ++p)
+			threads.emplace_back([&, p] {
+				std::vector<size_t> items;
+				for (size_t i = p; i < count; i += producers)
+					items.push_back(i);
+				if (batched)
+				{
+					for (size_t pos = 0; pos < items.size(); pos += 7)
+						queue.push(items.data() + pos, std::min<size_t>(7, items.size() - pos));
+				}
+				else
+				{
+					for (size_t item : items)
+						queue.push(item);
+				}
+				});
+		for (size_t c = 0; c < consumers; ++c)
+			threads.emplace_back([&] {
+				size_t buf[5];
+				unsigned long long local = 0;
+				while (popped.load(std::memory_order_relaxed) < count)
+				{
+					size_t n = queue.try_pop(buf, 5);
+					for (size_t i = 0; i < n; ++i)
+						local += buf[i];
+					popped.fetch_add(n, std::memory_order_relaxed);
+					if (n == 0)
+						std::this_thread::yield();
+				}
+				sum.fetch_add(local);
+				});
+		for (std::thread& t : threads)
+			t.join();
+		MOZAIC_CHECK(popped.load() == count);
+		MOZAIC_CHECK(sum.load() == (unsigned long long)count * (count - 1) / 2);
+		MOZAIC_CHECK(queue.empty());
+	}
+
+	// A single consumer must see each producer's items in the order they were pushed.
+	template<typename Queue>
+	void fifo(size_t count)
+	{
+		Queue queue(8);
+		std::thread producer([&] {
+			for (size_t i = 0; i < count; ++i)
+				queue.push(i);
+			});
+		bool ordered = true;
+		for (size_t i = 0; i < count; ++i)
+			ordered = ordered && queue.pop() == i;
+		producer.join();
+		MOZAIC_CHECK(ordered);
+	}
+
+	template<typename Queue>
+	void single_thread()
+	{
+		Queue queue(5);
+		MOZAIC_CHECK(queue.capacity() == 8 && queue.empty());
+		for (int i = 0; i < 8; ++i)
+			MOZAIC_CHECK(queue.try_push(i));
+		MOZAIC_CHECK(!queue.try_push(8) && queue.size() == 8);
+		int item = -1;
+		MOZAIC_CHECK(queue.try_pop(item) && item == 0);
+		var_array<int> out(10);
+		MOZAIC_CHECK(queue.try_pop(out) == 7 && out[0] == 1 && out[6] == 7);
+		MOZAIC_CHECK(!queue.try_pop(item));
+
+		// claims stop at the end of storage, so a batch across the wrap point takes two spans
+		const int three[3] = { 0, 0, 0 };
+		MOZAIC_CHECK(queue.try_push(three, 3) == 3 && queue.try_pop(out) == 3);
+		var_array<int> batch(6);
+		for (int i = 0; i < 6; ++i)
+			batch[i] = 10 + i;
+		MOZAIC_CHECK(queue.try_push(batch) == 6);
+		ring_span<int> span = queue.claim_read(6);
+		MOZAIC_CHECK(span.length() == 5 && span[0] == 10 && span[4] == 14);
+		queue.commit_read(span);
+		MOZAIC_CHECK(queue.size() == 1);
+		span = queue.claim_read(6);
+		MOZAIC_CHECK(span.length() == 1 && span[0] == 15);
+		queue.commit_read(span);
+		MOZAIC_CHECK(queue.empty() && !queue.claim_read(1));
+	}
+
+	const bool registered = [] {
+		test::add("queues/single_thread", [] {
+			single_thread<spsc_ring<int>>();
+			single_thread<mpmc_queue<int>>();
+			});
+		test::add("queues/spsc_stress", [] {
+			stress<spsc_ring<size_t>>(1, 1, messages, false);
+			stress<spsc_ring<size_t>>(1, 1, messages, true);
+			stress<spsc_ring<size_t, blocking_wait>>(1, 1, messages, true);
+			fifo<spsc_ring<size_t>>(messages);
+			fifo<spsc_ring<size_t, blocking_wait>>(messages);
+			});
+		test::add("queues/mpmc_stress", [] {
+			stress<mpmc_queue<size_t>>(4, 4, messages, false);
+			stress<mpmc_queue<size_t>>(3, 2, messages, true);
+			stress<mpmc_queue<size_t, blocking_wait>>(2, 3, messages, false);
+			stress<mpmc_queue<size_t, blocking_wait>>(4, 4, messages, true);
+			fifo<mpmc_queue<size_t>>(messages);
+			fifo<mpmc_queue<size_t, blocking_wait>>(messages);
+			});
+		return true;
+		}();
+}
@@ -0,0 +1,129 @@
+#include "test.hpp"
+
+#include "include/resample.hpp"
+
+#include <string>
+
+using namespace mozaic;
+
+// Built twice, as mozaic_tests and as mozaic_tests_no_simd with MOZAIC_NO_SIMD, so that both the vector and the scalar
+// kernels are checked against the same straightforward reference.
+
+namespace
+{
+	buffer2d random_buffer(size_t width, size_t height, size_t chpp, unsigned long long seed)
+	{
+		buffer2d buf(width, height, chpp, false);
+		test::xorshift rng{ seed };
+		for (size_t i = 0; i < buf.bytes(); ++i)
+			buf.buffer()[i] = std::byte(rng());
+		return buf;
+	}
+
+	bool equal(const buffer2d& a, const buffer2d& b)
+	{
+		return a.width() == b.width() && a.height() == b.height() && a.chpp() == b.chpp() && std::memcmp(a.buffer(), b.buffer(), a.bytes()) == 0;
+	}
+
+	// Per-sample fixed-point sums over the same weights as resize(): horizontal pass into 8 bits, then vertical pass.
+	buffer2d reference_resize(const buffer2d& src, size_t width, size_t height, resample_filter filter)
+	{
+		const size_t chpp = src.chpp();
+		__rsm::coefficients hco(src.width(), width, filter);
+		__rsm::coefficients vco(src.height(), height, filter);
+		buffer2d temp(width, src.height(), chpp);
+		for (size_t y = 0; y < src.height(); ++y)
+			for (size_t x = 0; x < width; ++x)
+				for (size_t c = 0; c < chpp; ++c)
+				{
+					int32_t acc = 1 << (__rsm::PRECISION - 1);
+					for (size_t k = 0; k < hco.taps; ++k)
+						acc += int32_t(hco.weights_of(x)[k]) * int32_t(src.pixel(hco.start[x] + k, y)[c]);
+					temp.pixel(x, y)[c] = __rsm::clamp_fixed(acc);
+				}
+		buffer2d dst(width, height, chpp);
+		for (size_t y = 0; y < height; ++y)
+			for (size_t x = 0; x < width; ++x)
+				for (size_t c = 0; c < chpp; ++c)
+				{
+					int32_t acc = 1 << (__rsm::PRECISION - 1);
+					for (size_t k = 0; k < vco.taps; ++k)
+						acc += int32_t(vco.weights_of(y)[k]) * int32_t(temp.pixel(x, vco.start[y] + k)[c]);
+					dst.pixel(x, y)[c] = __rsm::clamp_fixed(acc);
+				}
+		return dst;
+	}
+
+	// Rounded average of each 2x2 block, clamping the last column and row of odd dimensions.
+	buffer2d reference_downsample(const buffer2d& src)
+	{
+		buffer2d dst(std::max<size_t>(1, src.width() / 2), std::max<size_t>(1, src.height() / 2), src.chpp());
+		for (size_t y = 0; y < dst.height(); ++y)
+			for (size_t x = 0; x < dst.width(); ++x)
+				for (size_t c = 0; c < src.chpp(); ++c)
+				{
+					size_t x0 = 2 * x, x1 = std::min(2 * x + 1, src.width() - 1);
+					size_t y0 = 2 * y, y1 = std::min(2 * y + 1, src.height() - 1);
+					unsigned sum = unsigned(src.pixel(x0, y0)[c]) + unsigned(src.pixel(x1, y0)[c]) + unsigned(src.pixel(x0, y1)[c]) + unsigned(src.pixel(x1, y1)[c]);
+					dst.pixel(x, y)[c] = std::byte((sum + 2) >> 2);
+				}
+		return dst;
+	}
+
+	const bool registered = [] {
+		test::add("resample/resize_matches_reference", [] {
+			const size_t sizes[][4] = { { 37, 23, 80, 51 }, { 64, 64, 17, 9 }, { 100, 7, 33, 40 }, { 5, 5, 5, 5 }, { 1, 3, 4, 1 } };
+			const resample_filter filters[] = { resample_filter::box, resample_filter::bilinear, resample_filter::lanczos };
+			unsigned long long seed = 1;
+			for (const auto& s : sizes)
+				for (size_t chpp : { 1, 3, 4 })
+					for (resample_filter filter : filters)
+					{
+						buffer2d src = random_buffer(s[0], s[1], chpp, seed++);
+						buffer2d expected = reference_resize(src, s[2], s[3], filter);
+						MOZAIC_CHECK(equal(resize(src, s[2], s[3], filter, 1), expected));
+						MOZAIC_CHECK(equal(resize(src, s[2], s[3], filter, 3), expected));
+					}
+			});
+
+		test::add("resample/resize_constant_and_identity", [] {
+			buffer2d flat(31, 17, 4);
+			const std::byte px[4] = { std::byte(10), std::byte(200), std::byte(0), std::byte(255) };
+			flat.set(px, upright_rect{ 0, 30, 0, 16 });
+			for (resample_filter filter : { resample_filter::box, resample_filter::bilinear, resample_filter::lanczos })
+			{
+				buffer2d out = resize(flat, 50, 9, filter);
+				bool constant = true;
+				for (size_t y = 0; y < out.height(); ++y)
+					for (size_t x = 0; x < out.width(); ++x)
+						constant = constant && std::memcmp(out.pixel(x, y), px, 4) == 0;
+				MOZAIC_CHECK(constant);
+			}
+			buffer2d src = random_buffer(40, 30, 3, 42);
+			MOZAIC_CHECK(equal(resize(src, 40, 30, resample_filter::box), src));
+			});
+
+		test::add("resample/mipmaps_match_reference", [] {
+			const size_t sizes[][2] = { { 64, 64 }, { 97, 33 }, { 1, 9 }, { 130, 2 }, { 300, 257 } };
+			unsigned long long seed = 100;
+			for (const auto& s : sizes)
+				for (size_t chpp : { 1, 3, 4 })
+				{
+					buffer2d src = random_buffer(s[0], s[1], chpp, seed++);
+					for (size_t threads : { 1, 4 })
+					{
+						std::vector<buffer2d> levels = mipmap_chain(src, 0, threads);
+						const buffer2d* prev = &src;
+						for (const buffer2d& level : levels)
+						{
+							MOZAIC_CHECK(equal(level, reference_downsample(*prev)));
+							prev = &level;
+						}
+						MOZAIC_CHECK(!levels.empty() && levels.back().width() == 1 && levels.back().height() == 1);
+					}
+				}
+			MOZAIC_CHECK(mipmap_chain(random_buffer(64, 64, 4, 1), 2).size() == 2);
+			});
+		return true;
+		}();
+}
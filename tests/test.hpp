@@ -0,0 +1,62 @@
+#pragma once
+
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace mozaic::test
+{
+	// A test body checks its expectations with MOZAIC_CHECK, which throws on the first failure.
+	struct test_case
+	{
+		std::string name;
+		std::function<void()> body;
+	};
+
+	inline std::vector<test_case>& tests()
+	{
+		static std::vector<test_case> list;
+		return list;
+	}
+
+	inline void add(std::string name, std::function<void()> body)
+	{
+		tests().push_back({ std::move(name), std::move(body) });
+	}
+
+	struct failure : public std::runtime_error
+	{
+		failure(const std::string& message, const char* file, int line) : std::runtime_error(std::string(file) + ":" + std::to_string(line) + ": " + message) {}
+	};
+
+	inline void check(bool condition, const char* expression, const char* file, int line)
+	{
+		if (!condition)
+			throw failure("check failed: " + std::string(expression), file, line);
+	}
+
+	// Deterministic generator so that every run tests identical data.
+	struct xorshift
+	{
+		unsigned long long state = 0x9E3779B97F4A7C15ull;
+
+		unsigned long long operator()()
+		{
+			state ^= state << 13;
+			state ^= state >> 7;
+			state ^= state << 17;
+			return state;
+		}
+	};
+}
+
+#define MOZAIC_CHECK(...) ::mozaic::test::check(static_cast<bool>(__VA_ARGS__), #__VA_ARGS__, __FILE__, __LINE__)
+#define MOZAIC_CHECK_THROWS(exception, ...) \
+	do \
+	{ \
+		bool _mozaic_thrown = false; \
+		try { __VA_ARGS__; } \
+		catch (const exception&) { _mozaic_thrown = true; } \
+		::mozaic::test::check(_mozaic_thrown, "throws " #exception ": " #__VA_ARGS__, __FILE__, __LINE__); \
+	} while (false)
@@ -0,0 +1,182 @@
+#include "test.hpp"
+
+#include "include/utf.hpp"
+
+#include <string>
+#include <vector>
+
+using namespace mozaic;
+
+namespace
+{
+	// Code points from every UTF-8 sequence length, with runs of ASCII long enough to reach the vector loops.
+	std::string make_text(size_t code_points, unsigned long long seed)
+	{
+		static const char32_t ranges[][2] = { { 0x20, 0x7E }, { 0x80, 0x7FF }, { 0x800, 0xD7FF }, { 0xE000, 0xFFFF }, { 0x10000, 0x10FFFF } };
+		test::xorshift rng{ seed };
+		std::string s;
+		unsigned char encoded[4];
+		for (size_t i = 0; i < code_points; ++i)
+		{
+			const char32_t* r = ranges[rng() % 8 < 4 ? 0 : 1 + rng() % 4];
+			char32_t cp = char32_t(r[0] + rng() % (r[1] - r[0] + 1));
+			s.append(reinterpret_cast<const char*>(encoded), utf::__utf::encode(cp, encoded));
+		}
+		return s;
+	}
+
+	const std::vector<std::string> invalid_sequences = {
+		"\x80", "\xBF", "\xC0\xAF", "\xC1\xBF", "\xC2", "\xE0\x80\xAF", "\xE0\x9F\xBF", "\xED\xA0\x80", "\xED\xBF\xBF",
+		"\xE1\x80", "\xF0\x80\x80\xAF", "\xF0\x8F\xBF\xBF", "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xFF", "\xF0\x9F\x98",
+	};
+
+	template<typename F>
+	void for_each_isa(F f)
+	{
+		const utf::isa detected = utf::detected_isa();
+		for (int set = 0; set <= static_cast<int>(detected); ++set)
+		{
+			utf::use_isa(static_cast<utf::isa>(set));
+			f();
+		}
+		utf::use_isa(detected);
+	}
+
+	const bool registered = [] {
+		test::add("utf/validate_matches_scalar", [] {
+			std::vector<std::string> texts = { "", "plain ascii", std::string(100, 'a') };
+			for (unsigned long long seed = 1; seed <= 8; ++seed)
+				texts.push_back(make_text(50 + seed * 97, seed));
+			for (const std::string& bad : invalid_sequences)
+			{
+				// place each error at every offset within a vector block, before and after multi-byte text
+				for (size_t offset = 0; offset < 70; offset += 3)
+				{
+					texts.push_back(std::string(offset, 'a') + bad + std::string(70, 'b'));
+					texts.push_back(make_text(offset, offset + 1) + bad + make_text(40, 99));
+				}
+			}
+			utf::use_isa(utf::isa::scalar);
+			std::vector<size_t> expected;
+			for (const std::string& t : texts)
+				expected.push_back(utf::find_invalid_utf8(t.data(), t.size()));
+			for_each_isa([&] {
+				for (size_t i = 0; i < texts.size(); ++i)
+				{
+					MOZAIC_CHECK(utf::find_invalid_utf8(texts[i].data(), texts[i].size()) == expected[i]);
+					MOZAIC_CHECK(utf::validate_utf8(texts[i].data(), texts[i].size()) == (expected[i] == texts[i].size()));
+				}
+				});
+			for (const std::string& bad : invalid_sequences)
+				MOZAIC_CHECK(!utf::validate_utf8(bad.data(), bad.size()));
+			});
+
+		test::add("utf/round_trips", [] {
+			for_each_isa([] {
+				for (unsigned long long seed = 1; seed <= 6; ++seed)
+				{
+					const std::string text = make_text(1000 * seed, seed);
+					MOZAIC_CHECK(utf::validate_utf8(text.data(), text.size()));
+					var_array<char16_t> u16 = utf::utf8_to_utf16(text.data(), text.size());
+					MOZAIC_CHECK(u16.length() == utf::utf16_length_from_utf8(text.data(), text.size()));
+					var_array<char> back16 = utf::utf16_to_utf8(u16.get(), u16.length());
+					MOZAIC_CHECK(std::string(back16.get(), back16.length()) == text);
+					var_array<char32_t> u32 = utf::utf8_to_utf32(text.data(), text.size());
+					MOZAIC_CHECK(u32.length() == utf::count_utf8(text.data(), text.size()));
+					MOZAIC_CHECK(utf::utf8_length_from_utf32(u32.get(), u32.length()) == text.size());
+					var_array<char> back32 = utf::utf32_to_utf8(u32.get(), u32.length());
+					MOZAIC_CHECK(std::string(back32.get(), back32.length()) == text);
+				}
+				const std::string bad = std::string(40, 'a') + "\xED\xA0\x80";
+				MOZAIC_CHECK_THROWS(utf::encoding_error, utf::utf8_to_utf16(bad.data(), bad.size()));
+				const char16_t lone[] = { u'a', 0xD800, u'b' };
+				MOZAIC_CHECK_THROWS(utf::encoding_error, utf::utf16_to_utf8(lone, 3));
+				});
+			});
+
+		test::add("utf/two_byte_runs", [] {
+			// mostly one- and two-byte sequences, so that whole blocks reach the two-byte kernels, with a rare longer
+			// sequence to stop them anywhere within a block
+			std::vector<std::string> texts;
+			for (unsigned long long seed = 1; seed <= 40; ++seed)
+			{
+				test::xorshift rng{ seed };
+				std::string s;
+				unsigned char encoded[4];
+				for (size_t i = 0, n = 10 + rng() % 300; i < n; ++i)
+				{
+					unsigned r = unsigned(rng() % 100);
+					char32_t cp = r < 40 ? char32_t(0x20 + rng() % 0x5F) : r < 98 ? char32_t(0x80 + rng() % 0x780) : r < 99 ? char32_t(0x4E00 + rng() % 0x100) : char32_t(0x1F600 + rng() % 0x50);
+					s.append(reinterpret_cast<const char*>(encoded), utf::__utf::encode(cp, encoded));
+				}
+				texts.push_back(s);
+			}
+			utf::use_isa(utf::isa::scalar);
+			std::vector<std::u16string> expected16;
+			std::vector<std::u32string> expected32;
+			for (const std::string& text : texts)
+			{
+				var_array<char16_t> u16 = utf::utf8_to_utf16(text.data(), text.size());
+				var_array<char32_t> u32 = utf::utf8_to_utf32(text.data(), text.size());
+				expected16.emplace_back(u16.get(), u16.length());
+				expected32.emplace_back(u32.get(), u32.length());
+			}
+			for_each_isa([&] {
+				for (size_t t = 0; t < texts.size(); ++t)
+				{
+					const std::string& text = texts[t];
+					// exactly sized outputs, so that a kernel storing past the last code unit trips the sanitizers
+					var_array<char16_t> u16 = utf::utf8_to_utf16(text.data(), text.size());
+					var_array<char32_t> u32 = utf::utf8_to_utf32(text.data(), text.size());
+					MOZAIC_CHECK(std::u16string(u16.get(), u16.length()) == expected16[t]);
+					MOZAIC_CHECK(std::u32string(u32.get(), u32.length()) == expected32[t]);
+					var_array<char> back16 = utf::utf16_to_utf8(u16.get(), u16.length());
+					MOZAIC_CHECK(std::string(back16.get(), back16.length()) == text);
+					var_array<char> back32 = utf::utf32_to_utf8(u32.get(), u32.length());
+					MOZAIC_CHECK(std::string(back32.get(), back32.length()) == text);
+				}
+				});
+			});
+
+		test::add("utf/streaming_chunk_splits", [] {
+			for_each_isa([] {
+				const std::string text = make_text(300, 7);
+				const var_array<char16_t> expected = utf::utf8_to_utf16(text.data(), text.size());
+				// every split point of the text into two chunks, so that every sequence straddles a boundary once
+				for (size_t split = 0; split <= text.size(); ++split)
+				{
+					utf::utf8_validator validator;
+					MOZAIC_CHECK(validator.update(text.data(), split) && validator.update(text.data() + split, text.size() - split) && validator.finish());
+
+					utf::utf8_decoder<char16_t> decoder;
+					std::u16string out(decoder.max_output(split), u'\0');
+					out.resize(decoder.decode(text.data(), split, out.data()));
+					std::u16string rest(decoder.max_output(text.size() - split), u'\0');
+					rest.resize(decoder.decode(text.data() + split, text.size() - split, rest.data()));
+					decoder.finish();
+					out += rest;
+					MOZAIC_CHECK(out == std::u16string(expected.get(), expected.length()));
+				}
+				for (size_t chunk = 1; chunk <= 5; ++chunk)
+				{
+					utf::utf16_encoder encoder;
+					std::string out;
+					for (size_t pos = 0; pos < expected.length(); pos += chunk)
+					{
+						size_t n = std::min(chunk, expected.length() - pos);
+						std::string part(encoder.max_output(n), '\0');
+						part.resize(encoder.encode(expected.get() + pos, n, part.data()));
+						out += part;
+					}
+					encoder.finish();
+					MOZAIC_CHECK(out == text);
+				}
+				const std::string truncated = text + "\xF0\x9F";
+				utf::utf8_validator validator;
+				MOZAIC_CHECK(validator.update(truncated.data(), truncated.size()));
+				MOZAIC_CHECK(!validator.finish());
+				});
+			});
+		return true;
+		}();
+}